@@ -0,0 +1,266 @@
+module;
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <expected>
+#include <format>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <shared_mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+export module backend.alerts;
+
+import glaze;
+import pqxx;
+import spdlog;
+
+import common;
+import backend.utils;
+import backend.database;
+import backend.notifications;
+
+namespace backend::alerts {
+
+// Everything needed to send one notification. The pointers keep the rule set and resource of the time
+// the log was matched alive, even if the rules are reloaded in the meantime.
+export struct alert_event {
+    std::shared_ptr<const common::alert_rule> rule;
+    std::shared_ptr<const common::log_resource> resource;
+    std::shared_ptr<const common::log_entry> log;
+};
+
+// Sends notifications for matched alert rules on its own threads, so slow notification endpoints
+// do not hold up the database workers which ingest the logs.
+export class Dispatcher {
+    public:
+        constexpr static unsigned int default_thread_count = 4;
+        constexpr static std::size_t default_queue_capacity = 4096;
+        constexpr static unsigned int default_provider_concurrency = 2;
+
+        Dispatcher(database::Database& db, NetworkIpFilter* ip_filter, unsigned int thread_count = default_thread_count,
+            std::size_t queue_capacity = default_queue_capacity, unsigned int provider_concurrency = default_provider_concurrency)
+            : db(db), ip_filter(ip_filter), thread_count(thread_count), queue_capacity(queue_capacity), provider_concurrency(provider_concurrency),
+              logger(spdlog::default_logger()->clone("alerts"))
+        {
+
+        }
+
+        void start() {
+            logger->info("Starting {} alert dispatcher thread(s)", thread_count);
+            for(unsigned int i = 0; i < thread_count; i++) {
+                auto& thread = threads.emplace_back(std::bind(&Dispatcher::dispatch_thread, this, std::placeholders::_1));
+                pthread_setname_np(thread.native_handle(), std::format("alert-{}", i).c_str());
+            }
+            result_flusher = std::jthread(std::bind(&Dispatcher::result_thread, this, std::placeholders::_1));
+            pthread_setname_np(result_flusher.native_handle(), "alert-results");
+        }
+
+        // Builds the notification providers for the given rules. Providers of rules whose provider settings did not change are kept,
+        // so they can keep reusing their connections.
+        void load_rules(const std::map<unsigned int, common::alert_rule>& rules) {
+            std::unordered_map<unsigned int, cached_provider> new_providers;
+            std::unique_lock lock(providers_mutex);
+            for(const auto& [id, rule] : rules) {
+                std::string options = glz::write_json(rule.notification_options).value_or("null");
+                if(auto it = providers.find(id); it != providers.end()
+                    && it->second.name == rule.notification_provider && it->second.options == options)
+                {
+                    new_providers.emplace(id, std::move(it->second));
+                    continue;
+                }
+
+                auto provider = notifications::registry::instance()
+                    .create_provider(rule.notification_provider, *logger, rule.notification_options);
+                if(!provider) {
+                    logger->error("Failed to create notification provider {} for rule {}:{}: {}",
+                        rule.notification_provider, rule.id, rule.name, provider.error().message);
+                }
+                new_providers.emplace(id, cached_provider{rule.notification_provider, std::move(options),
+                    provider.transform([](auto&& p) { return std::shared_ptr<notifications::provider>(std::move(p)); })});
+            }
+            providers = std::move(new_providers);
+        }
+
+        // Queues a notification. If the queue is full, the notification is dropped and recorded as failed.
+        bool submit(alert_event event) {
+            {
+                std::unique_lock lock(mutex);
+                if(queue.size() < queue_capacity) {
+                    queue.push_back(std::move(event));
+                    cv.notify_one();
+                    return true;
+                }
+            }
+            logger->warn("Alert queue is full, dropping notification for rule {}:{}", event.rule->id, event.rule->name);
+            record_result(event.rule->id, "Alert queue is full, notification was dropped");
+            return false;
+        }
+    private:
+        constexpr static auto result_flush_interval = std::chrono::seconds(1);
+
+        struct cached_provider {
+            std::string name;
+            std::string options; // serialized, to detect changes
+            std::expected<std::shared_ptr<notifications::provider>, notifications::error> instance;
+        };
+        struct alert_result {
+            std::optional<std::string> message; // error message, or empty if the notification was sent successfully
+            std::chrono::system_clock::time_point time;
+        };
+
+        void dispatch_thread(std::stop_token st) {
+            while(!st.stop_requested()) {
+                alert_event event;
+                {
+                    std::unique_lock lock(mutex);
+                    auto it = queue.end();
+                    bool found = cv.wait(lock, st, [&] {
+                        it = std::ranges::find_if(queue, [this](const alert_event& e) { return can_dispatch(e); });
+                        return it != queue.end();
+                    });
+                    if(!found) {
+                        break;
+                    }
+                    event = std::move(*it);
+                    queue.erase(it);
+                    active[event.rule->notification_provider]++;
+                }
+
+                dispatch(event);
+
+                {
+                    std::unique_lock lock(mutex);
+                    active[event.rule->notification_provider]--;
+                }
+                cv.notify_all(); // events for this provider might be waiting
+            }
+        }
+        // Must be called with the mutex held.
+        bool can_dispatch(const alert_event& event) const {
+            auto it = active.find(event.rule->notification_provider);
+            return it == active.end() || it->second < provider_concurrency;
+        }
+
+        void dispatch(const alert_event& event) {
+            const auto& rule = *event.rule;
+            try {
+                logger->trace("Sending alert for rule {}:{}", rule.id, rule.name);
+                common::alert_stencil_object msg{
+                    .rule = &rule,
+                    .resource = event.resource.get(),
+                    .log = event.log.get()
+                };
+
+                auto provider = provider_for(rule);
+                if(!provider) {
+                    record_result(rule.id, provider.error().message);
+                    return;
+                }
+                auto result = (*provider)->notify(*logger, msg, ip_filter);
+                if(!result) {
+                    logger->error("Failed to send notification for rule {}:{}: {}",
+                        rule.id, rule.name, result.error().message);
+                    record_result(rule.id, result.error().message);
+                    return;
+                }
+                record_result(rule.id, std::nullopt);
+            } catch(const std::exception& e) {
+                logger->error("Unhandled exception while sending notification for rule {}:{}: {}", rule.id, rule.name, e.what());
+                record_result(rule.id, e.what());
+            }
+        }
+
+        std::expected<std::shared_ptr<notifications::provider>, notifications::error> provider_for(const common::alert_rule& rule) {
+            {
+                std::shared_lock lock(providers_mutex);
+                if(auto it = providers.find(rule.id); it != providers.end() && it->second.name == rule.notification_provider) {
+                    return it->second.instance;
+                }
+            }
+            // the rule was loaded without load_rules being called for it, which should not happen, but is no reason to fail
+            logger->warn("No cached notification provider for rule {}:{}, creating one", rule.id, rule.name);
+            return notifications::registry::instance()
+                .create_provider(rule.notification_provider, *logger, rule.notification_options)
+                .transform([](auto&& p) { return std::shared_ptr<notifications::provider>(std::move(p)); });
+        }
+
+        // Only the latest result of each rule is stored in the database, so older ones are simply replaced.
+        void record_result(unsigned int rule, std::optional<std::string> message) {
+            std::unique_lock lock(results_mutex);
+            results.insert_or_assign(rule, alert_result{std::move(message), std::chrono::system_clock::now()});
+        }
+
+        void result_thread(std::stop_token st) {
+            while(!st.stop_requested()) {
+                {
+                    std::unique_lock lock(results_mutex);
+                    // only woken up early to stop
+                    results_cv.wait_for(lock, st, result_flush_interval, [] { return false; });
+                }
+                flush_results();
+            }
+        }
+        void flush_results() {
+            std::unordered_map<unsigned int, alert_result> pending;
+            {
+                std::unique_lock lock(results_mutex);
+                pending.swap(results);
+            }
+            if(pending.empty()) {
+                return;
+            }
+
+            std::vector<unsigned int> ids;
+            std::vector<std::optional<std::string>> messages;
+            std::vector<std::int64_t> times;
+            for(auto& [id, result] : pending) {
+                ids.push_back(id);
+                messages.push_back(std::move(result.message));
+                times.push_back(std::chrono::duration_cast<std::chrono::microseconds>(result.time.time_since_epoch()).count());
+            }
+
+            try {
+                db.queue_work(database::work_class::background, [&](pqxx::connection& conn) {
+                    pqxx::work txn(conn);
+                    txn.exec(pqxx::prepped{"update_alert_results"}, pqxx::params{txn, ids, messages, times});
+                    txn.commit();
+                }).get();
+            } catch(const std::exception& e) {
+                logger->error("Failed to store results of {} alert(s): {}", ids.size(), e.what());
+            }
+        }
+
+        database::Database& db;
+        NetworkIpFilter* ip_filter;
+        unsigned int thread_count;
+        std::size_t queue_capacity;
+        unsigned int provider_concurrency;
+        std::shared_ptr<spdlog::logger> logger;
+
+        std::mutex mutex;
+        std::condition_variable_any cv;
+        std::deque<alert_event> queue;
+        std::unordered_map<std::string, unsigned int> active; // notifications currently being sent per provider
+
+        std::shared_mutex providers_mutex;
+        std::unordered_map<unsigned int, cached_provider> providers;
+
+        std::mutex results_mutex;
+        std::condition_variable_any results_cv;
+        std::unordered_map<unsigned int, alert_result> results;
+
+        // declared last, so they are stopped before anything they use is destroyed
+        std::vector<std::jthread> threads;
+        std::jthread result_flusher;
+};
+
+}
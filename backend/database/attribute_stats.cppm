@@ -0,0 +1,181 @@
+module;
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+export module backend.database:attribute_stats;
+
+import glaze;
+
+namespace backend::database {
+
+export enum class json_type {
+    null, number, string, boolean, array, object
+};
+export json_type type_of(const glz::generic& value) {
+    if(value.is_number()) return json_type::number;
+    if(value.is_string()) return json_type::string;
+    if(value.is_boolean()) return json_type::boolean;
+    if(value.is_array()) return json_type::array;
+    if(value.is_object()) return json_type::object;
+    return json_type::null;
+}
+
+// A top-level attribute of a log and the type of its value
+export struct attribute_key {
+    std::string name;
+    json_type type;
+};
+export std::vector<attribute_key> attribute_keys(const glz::generic& attributes) {
+    std::vector<attribute_key> keys;
+    if(attributes.is_object()) {
+        keys.reserve(attributes.get_object().size());
+        for(const auto& [key, value] : attributes.get_object()) {
+            keys.emplace_back(key, type_of(value));
+        }
+    }
+    return keys;
+}
+
+export struct attribute_counts {
+    int count{}, count_null{}, count_number{}, count_string{}, count_boolean{}, count_array{}, count_object{};
+
+    void add(json_type type, int sign = 1) {
+        count += sign;
+        switch(type) {
+            case json_type::null:    count_null += sign;    break;
+            case json_type::number:  count_number += sign;  break;
+            case json_type::string:  count_string += sign;  break;
+            case json_type::boolean: count_boolean += sign; break;
+            case json_type::array:   count_array += sign;   break;
+            case json_type::object:  count_object += sign;  break;
+        }
+    }
+    void add(const glz::generic& value, int sign = 1) {
+        add(type_of(value), sign);
+    }
+
+    bool zero() const {
+        return count == 0 && count_null == 0 && count_number == 0 && count_string == 0
+            && count_boolean == 0 && count_array == 0 && count_object == 0;
+    }
+
+    attribute_counts& operator+=(const attribute_counts& other) {
+        count += other.count;
+        count_null += other.count_null;
+        count_number += other.count_number;
+        count_string += other.count_string;
+        count_boolean += other.count_boolean;
+        count_array += other.count_array;
+        count_object += other.count_object;
+        return *this;
+    }
+    attribute_counts& operator-=(const attribute_counts& other) {
+        count -= other.count;
+        count_null -= other.count_null;
+        count_number -= other.count_number;
+        count_string -= other.count_string;
+        count_boolean -= other.count_boolean;
+        count_array -= other.count_array;
+        count_object -= other.count_object;
+        return *this;
+    }
+};
+
+// Accumulates per-attribute count deltas in memory, so ingest does not have to touch the
+// log_attributes table (and fight over its hot rows) for every single log.
+// The map is striped by key hash, so concurrent workers rarely contend on the same mutex.
+export class AttributeStats {
+    public:
+        constexpr static std::size_t stripe_count = 16;
+
+        void record(const std::vector<attribute_key>& keys, int sign = 1) {
+            for(const auto& [key, type] : keys) {
+                auto& s = stripe_for(key);
+                std::unique_lock lock(s.mutex);
+                auto it = s.counts.find(std::string_view{key});
+                if(it == s.counts.end()) {
+                    it = s.counts.emplace(key, attribute_counts{}).first;
+                }
+                it->second.add(type, sign);
+            }
+            pending_rows.fetch_add(1, std::memory_order_relaxed);
+        }
+        void record(const glz::generic& attributes, int sign = 1) {
+            record(attribute_keys(attributes), sign);
+        }
+        void add(std::string_view key, const attribute_counts& delta) {
+            auto& s = stripe_for(key);
+            std::unique_lock lock(s.mutex);
+            auto it = s.counts.find(key);
+            if(it == s.counts.end()) {
+                it = s.counts.emplace(std::string{key}, attribute_counts{}).first;
+            }
+            it->second += delta;
+        }
+
+        std::size_t pending() const {
+            return pending_rows.load(std::memory_order_relaxed);
+        }
+
+        // Removes all accumulated deltas. The result is sorted, so applying it always locks rows in the same order.
+        std::map<std::string, attribute_counts> take() {
+            std::map<std::string, attribute_counts> result;
+            pending_rows.store(0, std::memory_order_relaxed);
+            for(auto& s : stripes) {
+                std::unordered_map<std::string, attribute_counts, string_hash, std::equal_to<>> counts;
+                {
+                    std::unique_lock lock(s.mutex);
+                    counts.swap(s.counts);
+                }
+                for(auto& [key, delta] : counts) {
+                    result[key] += delta;
+                }
+            }
+            return result;
+        }
+        // Puts deltas back, e.g. after applying them to the database failed.
+        void restore(const std::map<std::string, attribute_counts>& deltas) {
+            for(const auto& [key, delta] : deltas) {
+                add(key, delta);
+            }
+        }
+        // Returns a copy of all accumulated deltas and leaves them in place.
+        std::map<std::string, attribute_counts> peek() {
+            std::map<std::string, attribute_counts> result;
+            for(auto& s : stripes) {
+                std::unique_lock lock(s.mutex);
+                for(const auto& [key, delta] : s.counts) {
+                    result[key] += delta;
+                }
+            }
+            return result;
+        }
+    private:
+        struct string_hash {
+            using is_transparent = void;
+            std::size_t operator()(std::string_view sv) const {
+                return std::hash<std::string_view>{}(sv);
+            }
+        };
+        struct stripe {
+            std::mutex mutex;
+            std::unordered_map<std::string, attribute_counts, string_hash, std::equal_to<>> counts;
+        };
+
+        stripe& stripe_for(std::string_view key) {
+            return stripes[string_hash{}(key) % stripe_count];
+        }
+
+        std::array<stripe, stripe_count> stripes;
+        std::atomic<std::size_t> pending_rows{0};
+};
+
+}
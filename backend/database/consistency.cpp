@@ -1,82 +1,217 @@
 module;
 #include <chrono>
+#include <cstdint>
+#include <format>
+#include <future>
+#include <map>
+#include <mutex>
 #include <optional>
 #include <string>
-#include <thread>
+#include <utility>
+#include <vector>
 
 module backend.database;
 import spdlog;
 
 namespace backend::database {
 
-constexpr bool fast_integrity_check = true;
+// all partitions of logs, whether they were never checked, and the version of their change mark if they have one
+constexpr const char* partitions_query =
+    "SELECT c.relname AS partition, k.partition IS NULL AS unchecked, m.version "
+    "FROM pg_inherits i JOIN pg_class c ON c.oid = i.inhrelid "
+    "LEFT JOIN log_partition_checks k ON k.partition = c.relname LEFT JOIN log_partition_changes m ON m.partition = c.relname "
+    "WHERE i.inhparent = 'logs'::regclass";
 
 void Database::ensure_consistency() {
-    ensure_consistency(connections.front());
+    {
+        std::unique_lock lock(consistency_mutex);
+        consistency_requested = true;
+    }
+    consistency_cv.notify_one();
 }
 
-void Database::ensure_consistency(pqxx::connection& conn) {
-    pqxx::work txn{conn};
-    ensure_consistency(txn);
-    txn.commit();
+void Database::consistency_thread(std::stop_token st) {
+    while(!st.stop_requested()) {
+        {
+            std::unique_lock lock(consistency_mutex);
+            if(!consistency_cv.wait(lock, st, [this] { return consistency_requested; })) {
+                break;
+            }
+            consistency_requested = false;
+        }
+
+        try {
+            check_consistency(st);
+        } catch(const std::exception& e) {
+            logger->error("Database consistency check failed: {}", e.what());
+        }
+    }
 }
 
-void Database::ensure_consistency(pqxx::transaction_base& txn) {
-    logger->info("Ensuring database consistency, this may take a while...");
-
-    auto attributes_result = txn.exec("SELECT key, count(*) FROM(SELECT jsonb_object_keys(attributes) as key FROM logs) AS t GROUP BY key;");
-    for(auto [attribute, count] : attributes_result.iter<std::string, unsigned int>()) {
-        unsigned int count_null{}, count_number{}, count_string{}, count_boolean{}, count_array{}, count_object{};
-
-        if constexpr (!fast_integrity_check) {
-            auto type_result = txn.exec("SELECT jsonb_typeof(attributes->$1) as type, COUNT(*) as count FROM logs GROUP BY type;", pqxx::params{attribute});
-            for(auto [type, count] : type_result.iter<std::optional<std::string>, unsigned int>()) {
-                if(!type) {
-                    count_null = count;
-                } else if(type == "number") {
-                    count_number = count;
-                } else if(type == "string") {
-                    count_string = count;
-                } else if(type == "boolean") {
-                    count_boolean = count;
-                } else if(type == "array") {
-                    count_array = count;
-                } else if(type == "object") {
-                    count_object = count;
-                }
-            }
+void Database::check_consistency(std::stop_token st) {
+    // All partitions are scanned in one snapshot, exported by a connection of its own which stays open until every scan imported it.
+    pqxx::connection snapshot_conn(connection_string);
+    pqxx::transaction<pqxx::isolation_level::repeatable_read> snapshot_txn(snapshot_conn);
+
+    // The statistics as of the snapshot: what the tables hold, plus the deltas of committed logs which were not flushed yet.
+    // Writes after the snapshot mark their partitions again, so the marks seen here are only removed if they were not.
+    std::string snapshot;
+    std::map<std::string, attribute_counts> attributes;
+    LogCounts::deltas_type counts;
+    std::vector<std::string> partitions;
+    std::vector<std::string> changed;
+    std::vector<std::int64_t> versions; // of the marks of the changed partitions, 0 if they were never checked
+    {
+        std::unique_lock flush_lock(attribute_flush_mutex);
+        std::unique_lock commit_lock(statistics_commit_mutex);
+        snapshot = snapshot_txn.exec("SELECT pg_export_snapshot()").one_field().as<std::string>();
+        attributes = attribute_stats.peek();
+        counts = log_counts.peek();
+        {
+            // ingest has to mark the partitions it writes to from now on again
+            std::unique_lock changed_lock(changed_partitions_mutex);
+            changed_partitions.clear();
         }
+    }
+    for(auto [partition, unchecked, version] : snapshot_txn.exec(partitions_query).iter<std::string, bool, std::optional<std::int64_t>>()) {
+        if(unchecked || version) {
+            changed.push_back(partition);
+            versions.push_back(version.value_or(0));
+        }
+        partitions.push_back(std::move(partition));
+    }
+    if(changed.empty()) {
+        logger->info("Database is consistent, no partition changed since the last check");
+        return;
+    }
+    logger->info("Checking database consistency of {} changed partition(s) in the background...", changed.size());
+    auto started = std::chrono::steady_clock::now();
 
-        bool completed = false;
-        do {
-            try {
-                auto res = txn.exec(R"(INSERT INTO log_attributes
-                    (attribute, count, count_null, count_number, count_string, count_boolean, count_array, count_object)
-                    VALUES ($1, $2, $3, $4, $5, $6, $7, $8)
-                    ON CONFLICT (attribute) DO UPDATE SET
-                        count = EXCLUDED.count,
-                        count_null = EXCLUDED.count_null,
-                        count_number = EXCLUDED.count_number,
-                        count_string = EXCLUDED.count_string,
-                        count_boolean = EXCLUDED.count_boolean,
-                        count_array = EXCLUDED.count_array,
-                        count_object = EXCLUDED.count_object;)",
-                    {attribute, count, count_null, count_number, count_string, count_boolean, count_array, count_object});
-                if(res.affected_rows() != 1) {
-                    logger -> warn("Update of attribute {} returned {} rows, this is weird", attribute, res.affected_rows());
-                }
-                completed = true;
-            } catch (const pqxx::deadlock_detected& e) {
-                logger->warn("Deadlock detected while inserting attribute {}, retrying...", attribute);
-                std::this_thread::sleep_for(std::chrono::milliseconds(100));
-            } catch (const std::exception& e) {
-                logger->error("Internal error while inserting attribute {}: {}", attribute, e.what());
-                throw;
+    for(auto [attribute, count, count_null, count_number, count_string, count_boolean, count_array, count_object] :
+        snapshot_txn.exec("SELECT attribute, count, count_null, count_number, count_string, count_boolean, count_array, count_object "
+            "FROM log_attributes").iter<std::string, int, int, int, int, int, int, int>())
+    {
+        attributes[attribute] += attribute_counts{count, count_null, count_number, count_string, count_boolean, count_array, count_object};
+    }
+    for(auto [resource, scope, severity, day, count] :
+        snapshot_txn.exec("SELECT resource, scope, severity, day - DATE '1970-01-01', count FROM log_counts")
+            .iter<unsigned int, std::string, common::log_severity, int, std::int64_t>())
+    {
+        counts[{resource, std::move(scope), severity, std::chrono::sys_days{std::chrono::days{day}}}] += count;
+    }
+
+    // each partition is scanned by a worker of its own, the pool limits how many run at once
+    std::vector<std::future<void>> scans;
+    scans.reserve(changed.size());
+    for(const auto& partition : changed) {
+        scans.push_back(queue_work(work_class::background, [this, &partition, &snapshot, st](pqxx::connection& conn) {
+            if(!st.stop_requested()) {
+                check_partition(conn, partition, snapshot);
             }
-        } while(!completed);
-        logger->debug("Attribute {}: null={}, number={}, string={}, boolean={}, array={}, object={}", attribute, count_null, count_number, count_string, count_boolean, count_array, count_object);
+        }));
+    }
+    std::size_t failed = 0;
+    for(std::size_t i = 0; i < scans.size(); i++) {
+        try {
+            scans[i].get();
+        } catch(const std::exception& e) {
+            logger->error("Failed to check partition {}, it will be checked again next time: {}", changed[i], e.what());
+            failed++;
+        }
+    }
+    snapshot_txn.abort();
+    if(st.stop_requested()) {
+        return;
+    }
+    if(failed > 0) {
+        // without all partitions of the snapshot the drift is unknown, the next check corrects it
+        logger->warn("Database consistency check incomplete after {:%T}, {} partition(s) failed",
+            std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - started), failed);
+        return;
+    }
+
+    queue_work(work_class::background, [&](pqxx::connection& conn) {
+        correct_statistics(conn, partitions, changed, versions, attributes, counts);
+    }).get();
+    logger->info("Database consistency check complete after {:%T}",
+        std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - started));
+}
+
+void Database::check_partition(pqxx::connection& conn, const std::string& partition, const std::string& snapshot) {
+    pqxx::transaction<pqxx::isolation_level::repeatable_read> txn(conn);
+    txn.exec(std::format("SET TRANSACTION SNAPSHOT {}", txn.quote(snapshot)));
+    std::string table = txn.quote_name(partition);
+
+    txn.exec("DELETE FROM log_partition_attributes WHERE partition = $1", pqxx::params{partition});
+    txn.exec(std::format(
+        "INSERT INTO log_partition_attributes "
+        "(partition, attribute, count, count_null, count_number, count_string, count_boolean, count_array, count_object) "
+        "SELECT $1, key, COUNT(*), "
+        "COUNT(*) FILTER (WHERE jsonb_typeof(value) = 'null'), "
+        "COUNT(*) FILTER (WHERE jsonb_typeof(value) = 'number'), "
+        "COUNT(*) FILTER (WHERE jsonb_typeof(value) = 'string'), "
+        "COUNT(*) FILTER (WHERE jsonb_typeof(value) = 'boolean'), "
+        "COUNT(*) FILTER (WHERE jsonb_typeof(value) = 'array'), "
+        "COUNT(*) FILTER (WHERE jsonb_typeof(value) = 'object') "
+        "FROM {} AS l, jsonb_each(l.attributes) GROUP BY key", table), pqxx::params{partition});
+
+    txn.exec("DELETE FROM log_partition_counts WHERE partition = $1", pqxx::params{partition});
+    txn.exec(std::format(
+        "INSERT INTO log_partition_counts (partition, resource, scope, severity, day, count) "
+        "SELECT $1, resource, scope, severity, timestamp::date, COUNT(*) FROM {} "
+        "GROUP BY resource, scope, severity, timestamp::date", table), pqxx::params{partition});
+
+    txn.exec("INSERT INTO log_partition_checks (partition) VALUES ($1) ON CONFLICT (partition) DO UPDATE SET checked_at = NOW()",
+        pqxx::params{partition});
+    txn.commit();
+    logger->debug("Checked partition {}", partition);
+}
+
+// Adds up the statistics of all partitions of the snapshot and adds the difference to what the statistics held to the tables.
+// As that only adds deltas, logs committed or removed after the snapshot keep being counted as usual. The difference is
+// applied in the transaction which unmarks the scanned partitions, so a crash loses either both or neither.
+void Database::correct_statistics(pqxx::connection& conn, const std::vector<std::string>& partitions,
+    const std::vector<std::string>& scanned, const std::vector<std::int64_t>& versions,
+    const std::map<std::string, attribute_counts>& expected_attributes, const LogCounts::deltas_type& expected_counts)
+{
+    std::map<std::string, attribute_counts> attributes;
+    LogCounts::deltas_type counts;
+    pqxx::work txn(conn);
+    txn.exec("DELETE FROM log_partition_checks WHERE partition <> ALL($1)", pqxx::params{txn, partitions});
+    txn.exec("DELETE FROM log_partition_attributes WHERE partition <> ALL($1)", pqxx::params{txn, partitions});
+    txn.exec("DELETE FROM log_partition_counts WHERE partition <> ALL($1)", pqxx::params{txn, partitions});
+
+    for(auto [attribute, count, count_null, count_number, count_string, count_boolean, count_array, count_object] :
+        txn.exec("SELECT attribute, sum(count)::integer, sum(count_null)::integer, sum(count_number)::integer, "
+            "sum(count_string)::integer, sum(count_boolean)::integer, sum(count_array)::integer, sum(count_object)::integer "
+            "FROM log_partition_attributes GROUP BY attribute").iter<std::string, int, int, int, int, int, int, int>())
+    {
+        attributes[attribute] += attribute_counts{count, count_null, count_number, count_string, count_boolean, count_array, count_object};
+    }
+    for(auto [resource, scope, severity, day, count] :
+        txn.exec("SELECT resource, scope, severity, day - DATE '1970-01-01', sum(count)::bigint FROM log_partition_counts "
+            "GROUP BY resource, scope, severity, day").iter<unsigned int, std::string, common::log_severity, int, std::int64_t>())
+    {
+        counts[{resource, std::move(scope), severity, std::chrono::sys_days{std::chrono::days{day}}}] += count;
+    }
+
+    for(const auto& [attribute, expected] : expected_attributes) {
+        attributes[attribute] -= expected;
+    }
+    for(const auto& [key, expected] : expected_counts) {
+        counts[key] -= expected;
+    }
+    std::erase_if(attributes, [](const auto& entry) { return entry.second.zero(); });
+    std::erase_if(counts, [](const auto& entry) { return entry.second == 0; });
+    apply_attribute_deltas(txn, attributes);
+    apply_log_count_deltas(txn, counts);
+    // marks which were bumped after the snapshot stay, the next check scans their partitions again
+    txn.exec("DELETE FROM log_partition_changes m USING unnest($1::text[], $2::bigint[]) AS s(partition, version) "
+        "WHERE m.partition = s.partition AND m.version = s.version", pqxx::params{txn, scanned, versions});
+    txn.commit();
+    if(!attributes.empty() || !counts.empty()) {
+        logger->warn("Corrected statistics of {} attribute(s) and {} log count(s)", attributes.size(), counts.size());
     }
-    logger->info("Database consistency check complete");
 }
 
 }
@@ -1,16 +1,23 @@
 module;
+#include <algorithm>
+#include <array>
 #include <chrono>
 #include <condition_variable>
+#include <cstdint>
 #include <deque>
 #include <format>
 #include <functional>
 #include <future>
 #include <map>
 #include <mutex>
+#include <optional>
 #include <ranges>
 #include <set>
+#include <shared_mutex>
 #include <string>
+#include <string_view>
 #include <thread>
+#include <tuple>
 #include <type_traits>
 #include <utility>
 #include <vector>
@@ -25,6 +32,13 @@ import glaze;
 
 import common;
 
+export import :attribute_stats;
+export import :listener;
+export import :log_counts;
+export import :partitions;
+export import :pool;
+export import :resource_registry;
+
 namespace pqxx {
     export template<> std::string const type_name<common::log_severity>{"log_severity"};
     export template<> struct nullness<common::log_severity> : pqxx::no_null<common::log_severity> {};
@@ -114,6 +128,35 @@ namespace pqxx {
         }
     };
 
+    export template<> std::string const type_name<common::ingest_action>{"ingest_action"};
+    export template<> struct nullness<common::ingest_action> : pqxx::no_null<common::ingest_action> {};
+    export template<> struct string_traits<common::ingest_action> {
+        [[nodiscard]] static constexpr std::string_view to_buf(std::span<char> buf, common::ingest_action const &value, ctx c = {}) {
+            if(std::to_underlying(value) >= common::ingest_action_names.size()) {
+                throw pqxx::conversion_error{std::format("Could not convert {} to ingest_action", std::to_underlying(value))};
+            }
+            return common::ingest_action_names[static_cast<std::underlying_type_t<common::ingest_action>>(value)];
+        }
+        [[nodiscard]] static constexpr std::size_t size_buffer(common::ingest_action const &value) noexcept {
+            constexpr std::size_t size = [](){
+                std::size_t size = 0;
+                for(const auto& name : common::ingest_action_names) {
+                    size = std::max(size, std::string_view::traits_type::length(name));
+                }
+                return size;
+            }();
+            return size;
+        }
+        [[nodiscard]] static constexpr common::ingest_action from_string(std::string_view text, ctx c = {}) {
+            for(std::underlying_type_t<common::ingest_action> i{}; i < common::ingest_action_names.size(); i++) {
+                if(text == common::ingest_action_names[i]) {
+                    return static_cast<common::ingest_action>(i);
+                }
+            }
+            throw pqxx::conversion_error{std::format("Could not convert {} to ingest_action", text)};
+        }
+    };
+
     export template<> std::string const type_name<glz::generic>{"glz::generic"};
     export template<> struct nullness<glz::generic> : pqxx::no_null<glz::generic> {};
     export template<> struct string_traits<glz::generic> {
@@ -192,56 +235,162 @@ common::standard_filters parse_filters(const pqxx::row_ref& row, const pqxx::con
     return filters;
 }
 
+export struct log_row {
+    unsigned int resource;
+    std::chrono::time_point<std::chrono::system_clock, std::chrono::nanoseconds> timestamp;
+    std::string scope;
+    common::log_severity severity;
+    std::string attributes; // serialized JSON object
+    std::string body; // serialized JSON value
+    std::vector<attribute_key> attribute_keys; // top-level keys of attributes, for the attribute statistics
+};
+
+// A data-modifying CTE (named removed_attributes) which subtracts the attributes of the given rows from log_attributes.
+// rows is a table or an earlier CTE with an attributes column. Rows are locked in the same order apply_attribute_deltas locks them.
+export std::string subtract_attributes_sql(std::string_view rows) {
+    return std::format(
+        "removed_attributes AS (INSERT INTO log_attributes "
+        "(attribute, count, count_null, count_number, count_string, count_boolean, count_array, count_object) "
+        "SELECT key, -COUNT(*), "
+        "-COUNT(*) FILTER (WHERE jsonb_typeof(value) = 'null'), "
+        "-COUNT(*) FILTER (WHERE jsonb_typeof(value) = 'number'), "
+        "-COUNT(*) FILTER (WHERE jsonb_typeof(value) = 'string'), "
+        "-COUNT(*) FILTER (WHERE jsonb_typeof(value) = 'boolean'), "
+        "-COUNT(*) FILTER (WHERE jsonb_typeof(value) = 'array'), "
+        "-COUNT(*) FILTER (WHERE jsonb_typeof(value) = 'object') "
+        "FROM {} AS r, jsonb_each(r.attributes) GROUP BY key ORDER BY key COLLATE \"C\" "
+        "ON CONFLICT (attribute) DO UPDATE SET "
+        "count = log_attributes.count + EXCLUDED.count, "
+        "count_null = log_attributes.count_null + EXCLUDED.count_null, "
+        "count_number = log_attributes.count_number + EXCLUDED.count_number, "
+        "count_string = log_attributes.count_string + EXCLUDED.count_string, "
+        "count_boolean = log_attributes.count_boolean + EXCLUDED.count_boolean, "
+        "count_array = log_attributes.count_array + EXCLUDED.count_array, "
+        "count_object = log_attributes.count_object + EXCLUDED.count_object)", rows);
+}
+
+// A data-modifying CTE (named marked_partitions) which marks the partitions of the given rows as changed, so the consistency
+// check rescans them. rows is a table or an earlier CTE with the tableoid of the logs.
+export std::string mark_partitions_sql(std::string_view rows) {
+    return std::format(
+        "marked_partitions AS (INSERT INTO log_partition_changes (partition) "
+        "SELECT DISTINCT c.relname FROM {} AS r JOIN pg_class c ON c.oid = r.tableoid ORDER BY c.relname "
+        "ON CONFLICT (partition) DO UPDATE SET version = log_partition_changes.version + 1)", rows);
+}
+
 export class Database {
     public:
-        constexpr static unsigned int default_worker_count = 4;
+        constexpr static std::size_t default_max_queue_size = 256;
 
-        Database(const std::string& connection_string, unsigned int worker_count = default_worker_count)
-            : connection_string(connection_string), logger(spdlog::default_logger()->clone("database"))
+        Database(const std::string& connection_string, pool_options options = {})
+            : connection_string(connection_string), logger(spdlog::default_logger()->clone("database")),
+              listener(connection_string, [this](pqxx::connection& conn) { prepare_statements(conn); }, logger),
+              pool(connection_string, options, [this](pqxx::connection& conn) { prepare_statements(conn); }, logger)
         {
-            connections.reserve(worker_count);
-            for(int i = 0; i < worker_count; i++) {
-                connections.emplace_back(connection_string);
-                auto& conn = connections.back();
-                conn.set_session_var("application_name", std::format("backend-worker-{}", i));
-            }
         }
 
         void run_migrations();
+        // Requests a consistency check of the attribute statistics and log counts. It runs in the background once the
+        // workers are started and only rescans partitions which changed since they were checked last.
         void ensure_consistency();
-        void ensure_consistency(pqxx::connection& conn);
-        void ensure_consistency(pqxx::transaction_base& txn);
 
         void start_workers() {
-            for(int i = 0; i < connections.size(); i++) {
-                auto& thread = threads.emplace_back([this, i](std::stop_token st) {
-                    worker(i, connections[i], st);
-                });
-                pthread_setname_np(thread.native_handle(), std::format("db-worker-{}", i).c_str());
-            }
+            listener.start();
+            pool.start();
+
+            // listen before loading, so resources inserted in between are not missed
+            listen("log_resources", [this](pqxx::notification notification) {
+                if(std::string_view{notification.payload}.empty()) { // resync after the listener reconnected
+                    pqxx::nontransaction txn(notification.conn);
+                    load_resources(txn);
+                    return;
+                }
+                auto id = common::from_chars<unsigned int>(std::string_view{notification.payload});
+                if(!id) {
+                    logger->warn("Received invalid log_resources notification: \"{}\"", std::string_view{notification.payload});
+                    return;
+                }
+                if(resource_registry.get(*id)) {
+                    return;
+                }
+                pqxx::nontransaction txn(notification.conn);
+                load_resources(txn, *id);
+            });
+            queue_work(work_class::interactive, [this](pqxx::connection& conn) {
+                pqxx::nontransaction txn(conn);
+                load_resources(txn);
+                load_partitions(txn);
+            }).get();
+            logger->info("Loaded {} resource(s)", resource_registry.size());
+
+            attribute_flusher = std::jthread([this](std::stop_token st) {
+                attribute_flush_thread(st);
+            });
+            pthread_setname_np(attribute_flusher.native_handle(), "db-attr-flush");
+
+            consistency_checker = std::jthread([this](std::stop_token st) {
+                consistency_thread(st);
+            });
+            pthread_setname_np(consistency_checker.native_handle(), "db-consistency");
         }
 
-        std::future<void> queue_work(std::move_only_function<void(pqxx::connection&)>&& work) {
+        // Limits how much ingest work may be queued before admit_work starts rejecting. 0 means unlimited.
+        void set_max_queue_size(std::size_t size) {
             std::unique_lock lock(mutex);
-            queue.emplace_back(std::move(work), std::promise<void>{});
-            cv.notify_one();
+            max_queue_size = size;
+        }
+        // Admission check for work from outside (like ingest requests), to be called before spending any effort on it.
+        // queue_work itself never rejects, so internal work and already admitted requests are not lost.
+        bool admit_work() {
+            std::unique_lock lock(mutex);
+            if(max_queue_size != 0 && pool.queued(work_class::ingest) >= max_queue_size) {
+                rejected_work++;
+                return false;
+            }
+            return true;
+        }
+        common::queue_stats queue_stats() {
+            std::unique_lock lock(mutex);
+            return common::queue_stats{
+                .depth = pool.queued(work_class::ingest),
+                .capacity = max_queue_size,
+                .rejected = rejected_work,
+                .connections = pool.size()
+            };
+        }
+
+        std::future<void> queue_work(work_class cls, std::move_only_function<void(pqxx::connection&)>&& work) {
+            return pool.submit(cls, std::move(work));
+        }
 
-            return queue.back().second.get_future();
+        // Calls the handler for every notification on the channel. Handlers run on the listener thread.
+        void listen(std::string channel, Listener::handler_type handler) {
+            listener.listen(std::move(channel), std::move(handler));
         }
         unsigned int ensure_resource(pqxx::connection& conn, const glz::generic& attributes, unsigned int tries = 3) {
+            if(auto id = resource_registry.find(attributes)) {
+                return *id;
+            }
+
             try {
                 pqxx::work txn(conn);
                 pqxx::result res = txn.exec(pqxx::prepped{"find_resource"}, pqxx::params{txn, attributes});
-                if(res.size() == 1) {
-                    return res[0][0].as<unsigned int>();
-                } else if(res.size() == 0) {
+                if(res.size() == 0) {
                     res = txn.exec(pqxx::prepped{"insert_resource"}, pqxx::params{txn, attributes});
+                    txn.notify("log_resources", res[0]["id"].as<std::string>());
                     txn.commit();
-                    return res[0][0].as<unsigned int>();
-                } else {
+                } else if(res.size() != 1) {
                     logger->critical("Unexpected row count in ensure_resource: expected 0 or 1, but got {}", res.size());
                     throw std::logic_error("Unexpected row count in ensure_resource");
                 }
+
+                unsigned int id = res[0]["id"].as<unsigned int>();
+                resource_registry.insert(common::log_resource{
+                    .id = id,
+                    .attributes = attributes,
+                    .created_at = res[0]["created_at"].as<double>(),
+                });
+                return id;
             } catch (const pqxx::deadlock_detected& e) {
                 if(tries > 0) {
                     logger->warn("Deadlock detected in ensure_resource, retrying");
@@ -251,22 +400,49 @@ export class Database {
                 throw;
             }
         };
-        void create_partition(pqxx::connection& conn, std::chrono::time_point<std::chrono::system_clock, std::chrono::nanoseconds> timestamp) {
-            std::chrono::sys_days day = std::chrono::floor<std::chrono::days>(timestamp);
-            std::chrono::year_month_day ymd{day};
-            std::string partition_name = std::format("logs_{:04}{:02}{:02}",
-                static_cast<int>(ymd.year()),
-                static_cast<unsigned int>(ymd.month()),
-                static_cast<unsigned int>(ymd.day()));
-
-            auto from = std::chrono::time_point_cast<std::chrono::seconds>(day);
-            auto to = std::chrono::time_point_cast<std::chrono::seconds>(day + std::chrono::days{1});
+        ResourceRegistry& resources() {
+            return resource_registry;
+        }
+        void set_partition_granularity(partition_granularity granularity) {
+            this->granularity = granularity;
+        }
+        const PartitionSet& partitions() const {
+            return partition_set;
+        }
+        void load_partitions(pqxx::transaction_base& txn) {
+            std::vector<partition_range> ranges;
+            for(auto [name, from, to] : txn.exec(pqxx::prepped{"get_partitions"}).iter<std::string, std::optional<double>, std::optional<double>>()) {
+                if(!from || !to) {
+                    logger->trace("Ignoring partition {} without a lower or upper bound", name);
+                    continue;
+                }
+                ranges.emplace_back(std::move(name),
+                    std::chrono::sys_seconds{std::chrono::seconds{static_cast<std::int64_t>(*from)}},
+                    std::chrono::sys_seconds{std::chrono::seconds{static_cast<std::int64_t>(*to)}});
+            }
+            logger->debug("Found {} partition(s) of logs", ranges.size());
+            partition_set.replace(std::move(ranges));
+        }
+        // Makes sure a partition for the timestamp exists, creating it with the configured granularity if needed.
+        void ensure_partition(pqxx::connection& conn, std::chrono::sys_seconds timestamp) {
+            if(partition_set.contains(timestamp)) {
+                return;
+            }
 
+            std::unique_lock lock(partition_mutex);
+            if(partition_set.contains(timestamp)) { // someone else might have been faster
+                return;
+            }
+            partition_range range = partition_set.plan(timestamp, granularity);
+            create_partition(conn, range);
+            partition_set.insert(std::move(range));
+        }
+        void create_partition(pqxx::connection& conn, const partition_range& range) {
             std::string create_partition_sql = std::format(
                 "CREATE TABLE IF NOT EXISTS {} PARTITION OF logs FOR VALUES FROM (to_timestamp({})) TO (to_timestamp({}))",
-                partition_name,
-                from.time_since_epoch().count(),
-                to.time_since_epoch().count()
+                conn.quote_name(range.name),
+                range.from.time_since_epoch().count(),
+                range.to.time_since_epoch().count()
             );
             logger->info("Creating partition with SQL: {}", create_partition_sql);
 
@@ -274,61 +450,180 @@ export class Database {
             txn.exec(create_partition_sql);
             txn.commit();
         }
+        // Applies attribute count deltas to log_attributes with a single statement. The deltas are sorted by key (bytewise,
+        // like COLLATE "C"), so concurrent callers always lock rows in the same order.
+        void apply_attribute_deltas(pqxx::transaction_base& txn, const std::map<std::string, attribute_counts>& deltas) {
+            std::vector<std::string_view> keys;
+            std::array<std::vector<int>, 7> counts;
+            keys.reserve(deltas.size());
+            for(auto& c : counts) {
+                c.reserve(deltas.size());
+            }
+            for(const auto& [key, delta] : deltas) {
+                if(delta.zero()) {
+                    continue;
+                }
+                keys.push_back(key);
+                counts[0].push_back(delta.count);
+                counts[1].push_back(delta.count_null);
+                counts[2].push_back(delta.count_number);
+                counts[3].push_back(delta.count_string);
+                counts[4].push_back(delta.count_boolean);
+                counts[5].push_back(delta.count_array);
+                counts[6].push_back(delta.count_object);
+            }
+            if(keys.empty()) {
+                return;
+            }
+
+            txn.exec(pqxx::prepped{"update_attributes"}, pqxx::params{txn, keys,
+                counts[0], counts[1], counts[2], counts[3], counts[4], counts[5], counts[6]});
+        }
+
+        // Detaches and drops a whole partition, which (unlike DELETE) writes next to no WAL and leaves no bloat behind.
+        // Its logs are subtracted from log_counts and log_attributes in the same transaction. Returns the number of dropped logs.
+        std::size_t drop_partition(pqxx::connection& conn, const partition_range& range) {
+            std::string table = conn.quote_name(range.name);
+            logger->info("Dropping partition {}", range.name);
+
+            pqxx::work txn(conn);
+            auto dropped = txn.exec(std::format(
+                "WITH counted AS (SELECT resource, scope, severity, timestamp::date AS day, COUNT(*) AS count FROM {} "
+                "GROUP BY resource, scope, severity, timestamp::date), "
+                "adjusted AS (INSERT INTO log_counts (resource, scope, severity, day, count) "
+                "SELECT resource, scope, severity, day, -count FROM counted ORDER BY resource, scope, severity, day "
+                "ON CONFLICT (resource, scope, severity, day) DO UPDATE SET count = log_counts.count + EXCLUDED.count) "
+                "SELECT coalesce(sum(count), 0)::bigint FROM counted", table)).one_field().as<std::size_t>();
+            txn.exec(std::format("WITH {} SELECT 1", subtract_attributes_sql(table)));
+            // the statistics of the partition go with it, so there is nothing left for the consistency check to rescan
+            txn.exec("DELETE FROM log_partition_changes WHERE partition = $1", pqxx::params{range.name});
+            txn.exec("DELETE FROM log_partition_checks WHERE partition = $1", pqxx::params{range.name});
+            txn.exec("DELETE FROM log_partition_attributes WHERE partition = $1", pqxx::params{range.name});
+            txn.exec("DELETE FROM log_partition_counts WHERE partition = $1", pqxx::params{range.name});
+            // detaching locks all of logs, so rather fail than make ingest wait behind a long running query
+            txn.exec("SET LOCAL lock_timeout = '5s'");
+            txn.exec(std::format("ALTER TABLE logs DETACH PARTITION {}", table));
+            txn.exec(std::format("DROP TABLE {}", table));
+            txn.commit();
+
+            partition_set.erase(range.name);
+            return dropped;
+        }
         void insert_log(pqxx::connection& conn, unsigned int resource, std::chrono::time_point<std::chrono::system_clock, std::chrono::nanoseconds> timestamp,
             const std::string& scope, common::log_severity severity, const glz::generic& attributes, const glz::generic& body, unsigned int tries = 3)
         {
+            std::vector<log_row> rows;
+            rows.emplace_back(resource, timestamp, scope, severity,
+                glz::write_json(attributes).value_or("{}"), glz::write_json(body).value_or("null"), attribute_keys(attributes));
+            insert_logs(conn, rows, false, tries);
+        }
+        // Inserts all rows inside a single transaction and returns which of them were inserted. Timestamps of rows which
+        // collide with already existing logs are shifted by 1 us (like insert_log always did), so the vector is modified in-place.
+        // Rows which are replayed might have been inserted before. Those colliding with an identical log count as already
+        // written and are skipped, the others are shifted like any other row.
+        std::vector<bool> insert_logs(pqxx::connection& conn, std::vector<log_row>& rows, bool replay = false, unsigned int tries = 3) {
+            std::vector<bool> written(rows.size());
+            if(rows.empty()) {
+                return written;
+            }
+
+            std::chrono::sys_seconds last_checked{};
+            for(const auto& row : rows) {
+                auto ts = std::chrono::floor<std::chrono::seconds>(row.timestamp);
+                if(ts != last_checked) { // rows of one batch usually share a handful of timestamps
+                    ensure_partition(conn, ts);
+                    last_checked = ts;
+                }
+            }
+
             try {
                 pqxx::work txn(conn);
-                std::chrono::time_point<std::chrono::system_clock, std::chrono::duration<double, std::chrono::seconds::period>> ts_seconds = timestamp;
-                txn.exec(pqxx::prepped{"insert_log"}, pqxx::params{txn, resource, ts_seconds.time_since_epoch().count(), scope, severity, attributes, body});
-
-                if(attributes.is_object() && attributes.size() > 0){
-                    std::string select_for_update = "SELECT * FROM log_attributes WHERE attribute IN (";
-                    bool first = true;
-                    for(const auto& [key, value] : attributes.get_object()) {
-                        if(!first) {
-                            select_for_update += ", ";
+
+                std::vector<log_row*> pending;
+                std::vector<log_row*> inserted;
+                pending.reserve(rows.size());
+                inserted.reserve(rows.size());
+                for(auto& row : rows) {
+                    pending.push_back(&row);
+                }
+
+                for(unsigned int attempt = 0; !pending.empty(); attempt++) {
+                    if(attempt > 0) {
+                        if(replay) {
+                            auto colliding = pending.size();
+                            pending = find_unwritten_rows(txn, pending);
+                            if(pending.size() < colliding) {
+                                logger->info("Skipping {} replayed log(s) in insert_logs which were written before", colliding - pending.size());
+                            }
+                            if(pending.empty()) {
+                                break;
+                            }
+                        }
+                        if(attempt > max_unique_violation_retries) {
+                            logger->error("Unique violation detected for {} log(s) in insert_logs, giving up", pending.size());
+                            break;
+                        }
+                        logger->warn("Unique violation detected for {} log(s) in insert_logs, retrying with timestamp + 1 us", pending.size());
+                        for(auto* row : pending) {
+                            row->timestamp += std::chrono::microseconds(1);
                         }
-                        select_for_update += txn.quote(key);
-                        first = false;
                     }
-                    select_for_update += ") FOR UPDATE";
-                    txn.exec(select_for_update);
+                    pending = insert_log_rows(txn, pending, inserted);
                 }
 
-                if(attributes.is_object()) {
-                    auto view = attributes.get_object() | std::views::keys;
-                    std::set<std::string> keys(view.begin(), view.end());
-
-                    for(const auto& key : keys) {
-                        const auto& value = attributes[key];
-                        txn.exec(pqxx::prepped{"update_attribute"}, pqxx::params{key, 1,
-                            static_cast<int>(value.is_null()), static_cast<int>(value.is_number()), static_cast<int>(value.is_string()),
-                            static_cast<int>(value.is_boolean()), static_cast<int>(value.is_array()), static_cast<int>(value.is_object())
-                        });
+                LogCounts::deltas_type count_deltas;
+                std::set<std::string> changed;
+                std::chrono::sys_seconds last_marked{};
+                for(const auto* row : inserted) {
+                    count_deltas[{row->resource, row->scope, row->severity, std::chrono::floor<std::chrono::days>(row->timestamp)}]++;
+                    auto ts = std::chrono::floor<std::chrono::seconds>(row->timestamp);
+                    if(ts != last_marked) {
+                        if(auto partition = partition_set.name_of(ts)) {
+                            changed.insert(std::move(*partition));
+                        }
+                        last_marked = ts;
                     }
                 }
-                txn.commit();
+                {
+                    // a consistency check must see these logs committed, marked and recorded, or none of it
+                    std::shared_lock commit_lock(statistics_commit_mutex);
+                    mark_partitions_changed(txn, changed);
+                    txn.commit();
+                    {
+                        std::unique_lock lock(changed_partitions_mutex);
+                        changed_partitions.merge(changed);
+                    }
+                    for(const auto* row : inserted) {
+                        attribute_stats.record(row->attribute_keys);
+                    }
+                    log_counts.add(count_deltas);
+                }
+                if(attribute_stats.pending() >= attribute_flush_rows) {
+                    attribute_flush_cv.notify_one();
+                }
+                for(const auto* row : inserted) {
+                    written[row - rows.data()] = true;
+                }
+                return written;
             } catch (const pqxx::deadlock_detected& e) {
                 if(tries > 0) {
-                    logger->warn("Deadlock detected in insert_log, retrying");
-                    insert_log(conn, resource, timestamp, scope, severity, attributes, body, tries - 1);
-                    return;
+                    logger->warn("Deadlock detected in insert_logs, retrying");
+                    return insert_logs(conn, rows, replay, tries - 1);
                 }
-                logger->error("Deadlock detected in insert_log, giving up");
+                logger->error("Deadlock detected in insert_logs, giving up");
                 throw;
-            } catch (const pqxx::unique_violation& c) {
+            } catch (const pqxx::check_violation& c) {
                 if(tries > 0) {
-                    logger->warn("Unique violation detected in insert_log, retrying with timestamp + 1 us");
-                    insert_log(conn, resource, timestamp + std::chrono::microseconds(1), scope, severity, attributes, body, tries - 1);
-                    return;
+                    // partitions might have been dropped or detached behind our back
+                    logger->warn("No partition for some of {} log(s), reloading partitions and retrying", rows.size());
+                    {
+                        pqxx::nontransaction txn(conn);
+                        load_partitions(txn);
+                    }
+                    return insert_logs(conn, rows, replay, tries - 1);
                 }
-                logger->error("Unique violation detected in insert_log, giving up");
-            } catch (const pqxx::check_violation& c) {
-                logger->debug("No partition for timestamp {}, creating partition and retrying", timestamp);
-                create_partition(conn, timestamp);
-                insert_log(conn, resource, timestamp, scope, severity, attributes, body, tries); // do not decrease tries, because this error is expected
-                return;
+                logger->error("No partition for some of {} log(s), giving up", rows.size());
+                throw;
             }
         }
 
@@ -396,15 +691,273 @@ export class Database {
             }
             return rules;
         }
+        std::map<unsigned int, common::ingest_rule> get_ingest_rules(pqxx::transaction_base& txn) {
+            auto result = txn.exec(pqxx::prepped{"get_ingest_rules"});
+            std::map<unsigned int, common::ingest_rule> rules;
+
+            for(const auto& row : result) {
+                unsigned int id = row["id"].as<unsigned int>();
+                common::ingest_rule& rule = rules[id];
+
+                rule.id = id;
+                rule.name = row["name"].as<std::string>();
+                rule.description = row["description"].as<std::string>();
+                rule.enabled = row["enabled"].as<bool>();
+
+                rule.filters = parse_filters(row, txn.conn());
+
+                rule.action = row["action"].as<common::ingest_action>();
+                rule.sample_rate = row["sample_rate"].as<double>();
+                if(auto actions = glz::read_json<std::vector<common::transform_action>>(row["transform_actions"].view()); actions) {
+                    rule.transform_actions = std::move(*actions);
+                } else {
+                    logger->warn("Disabling ingest rule {}:{} with invalid transform actions: {}", rule.id, rule.name, glz::format_error(actions.error()));
+                    rule.enabled = false;
+                }
+
+                rule.created_at = std::chrono::sys_seconds{std::chrono::duration_cast<std::chrono::seconds>(
+                    std::chrono::duration<double>{row["created_at_s"].as<double>()})};
+                rule.updated_at = std::chrono::sys_seconds{std::chrono::duration_cast<std::chrono::seconds>(
+                    std::chrono::duration<double>{row["updated_at_s"].as<double>()})};
+            }
+            return rules;
+        }
 
     private:
+        constexpr static unsigned int max_unique_violation_retries = 3;
+
+        // Inserts the given rows with a single statement and returns the ones which conflicted with existing logs.
+        std::vector<log_row*> insert_log_rows(pqxx::transaction_base& txn, const std::vector<log_row*>& rows, std::vector<log_row*>& inserted) {
+            std::vector<unsigned int> resources;
+            std::vector<std::int64_t> timestamps;
+            std::vector<std::string_view> scopes;
+            std::vector<common::log_severity> severities;
+            std::vector<std::string_view> attributes;
+            std::vector<std::string_view> bodies;
+            resources.reserve(rows.size());
+            timestamps.reserve(rows.size());
+            scopes.reserve(rows.size());
+            severities.reserve(rows.size());
+            attributes.reserve(rows.size());
+            bodies.reserve(rows.size());
+
+            for(const auto* row : rows) {
+                resources.push_back(row->resource);
+                timestamps.push_back(timestamp_us(row->timestamp));
+                scopes.push_back(row->scope);
+                severities.push_back(row->severity);
+                attributes.push_back(row->attributes);
+                bodies.push_back(row->body);
+            }
+
+            auto result = txn.exec(pqxx::prepped{"insert_logs"}, pqxx::params{txn, resources, timestamps, scopes, severities, attributes, bodies});
+            if(result.affected_rows() == rows.size()) {
+                inserted.insert(inserted.end(), rows.begin(), rows.end());
+                return {};
+            }
+
+            std::set<std::tuple<unsigned int, std::int64_t, std::string>> keys;
+            for(auto [resource, timestamp, scope] : result.iter<unsigned int, std::int64_t, std::string>()) {
+                keys.emplace(resource, timestamp, std::move(scope));
+            }
+            std::vector<log_row*> conflicting;
+            for(auto* row : rows) {
+                if(keys.contains(std::make_tuple(row->resource, timestamp_us(row->timestamp), row->scope))) {
+                    inserted.push_back(row);
+                } else {
+                    conflicting.push_back(row);
+                }
+            }
+            return conflicting;
+        }
+
+        // Marks the partitions as changed in the transaction writing to them, unless a committed transaction did so since the
+        // last consistency snapshot. Called with statistics_commit_mutex held, so a snapshot which sees the logs also sees the mark.
+        void mark_partitions_changed(pqxx::transaction_base& txn, const std::set<std::string>& partitions) {
+            std::vector<std::string_view> unmarked;
+            {
+                std::unique_lock lock(changed_partitions_mutex);
+                for(const auto& partition : partitions) {
+                    if(!changed_partitions.contains(partition)) {
+                        unmarked.push_back(partition);
+                    }
+                }
+            }
+            if(!unmarked.empty()) {
+                txn.exec(pqxx::prepped{"mark_partitions_changed"}, pqxx::params{txn, unmarked});
+            }
+        }
+
+        // Returns the rows which collided with a log other than themselves, i.e. one with different attributes or body.
+        std::vector<log_row*> find_unwritten_rows(pqxx::transaction_base& txn, const std::vector<log_row*>& rows) {
+            std::vector<unsigned int> resources;
+            std::vector<std::int64_t> timestamps;
+            std::vector<std::string_view> scopes;
+            std::vector<std::string_view> attributes;
+            std::vector<std::string_view> bodies;
+            resources.reserve(rows.size());
+            timestamps.reserve(rows.size());
+            scopes.reserve(rows.size());
+            attributes.reserve(rows.size());
+            bodies.reserve(rows.size());
+            for(const auto* row : rows) {
+                resources.push_back(row->resource);
+                timestamps.push_back(timestamp_us(row->timestamp));
+                scopes.push_back(row->scope);
+                attributes.push_back(row->attributes);
+                bodies.push_back(row->body);
+            }
+
+            std::vector<bool> written(rows.size());
+            for(auto [index] : txn.exec(pqxx::prepped{"find_written_logs"}, pqxx::params{txn, resources, timestamps, scopes, attributes, bodies})
+                .iter<std::size_t>())
+            {
+                written[index - 1] = true;
+            }
+            std::vector<log_row*> unwritten;
+            for(std::size_t i = 0; i < rows.size(); i++) {
+                if(!written[i]) {
+                    unwritten.push_back(rows[i]);
+                }
+            }
+            return unwritten;
+        }
+
+        static std::int64_t timestamp_us(std::chrono::time_point<std::chrono::system_clock, std::chrono::nanoseconds> timestamp) {
+            return std::chrono::duration_cast<std::chrono::microseconds>(timestamp.time_since_epoch()).count();
+        }
+
+        void load_resources(pqxx::transaction_base& txn, std::optional<unsigned int> id = std::nullopt) {
+            auto result = id ? txn.exec(pqxx::prepped{"get_resource"}, pqxx::params{*id}) : txn.exec(pqxx::prepped{"get_resources"});
+            for(const auto& row : result) {
+                resource_registry.insert(common::log_resource{
+                    .id = row["id"].as<unsigned int>(),
+                    .attributes = row["attributes"].as<glz::generic>(),
+                    .created_at = row["created_at"].as<double>(),
+                });
+            }
+        }
+
+        // Applies all accumulated attribute deltas with a single statement.
+        void flush_attribute_stats(pqxx::connection& conn) {
+            std::unique_lock lock(attribute_flush_mutex);
+            auto deltas = attribute_stats.take();
+            if(deltas.empty()) {
+                return;
+            }
+
+            try {
+                pqxx::work txn(conn);
+                apply_attribute_deltas(txn, deltas);
+                txn.commit();
+                logger->trace("Flushed attribute statistics for {} attribute(s)", deltas.size());
+            } catch(...) {
+                attribute_stats.restore(deltas);
+                throw;
+            }
+        }
+
+        // Applies all accumulated log count deltas with a single statement.
+        void flush_log_counts(pqxx::connection& conn) {
+            std::unique_lock lock(attribute_flush_mutex);
+            auto deltas = log_counts.take();
+            if(deltas.empty()) {
+                return;
+            }
+
+            try {
+                pqxx::work txn(conn);
+                apply_log_count_deltas(txn, deltas);
+                txn.commit();
+                logger->trace("Flushed log counts for {} key(s)", deltas.size());
+            } catch(...) {
+                log_counts.restore(deltas);
+                throw;
+            }
+        }
+        // Adds the deltas to log_counts. The map is sorted, so concurrent callers lock rows in the same order.
+        void apply_log_count_deltas(pqxx::transaction_base& txn, const LogCounts::deltas_type& deltas) {
+            std::vector<unsigned int> resources;
+            std::vector<std::string_view> scopes;
+            std::vector<common::log_severity> severities;
+            std::vector<std::int64_t> days;
+            std::vector<std::int64_t> counts;
+            resources.reserve(deltas.size());
+            scopes.reserve(deltas.size());
+            severities.reserve(deltas.size());
+            days.reserve(deltas.size());
+            counts.reserve(deltas.size());
+            for(const auto& [key, delta] : deltas) {
+                resources.push_back(key.resource);
+                scopes.push_back(key.scope);
+                severities.push_back(key.severity);
+                days.push_back(key.day.time_since_epoch().count());
+                counts.push_back(delta);
+            }
+            if(resources.empty()) {
+                return;
+            }
+
+            txn.exec(pqxx::prepped{"update_log_counts"}, pqxx::params{txn, resources, scopes, severities, days, counts});
+        }
+
+        void consistency_thread(std::stop_token st);
+        void check_consistency(std::stop_token st);
+        void check_partition(pqxx::connection& conn, const std::string& partition, const std::string& snapshot);
+        void correct_statistics(pqxx::connection& conn, const std::vector<std::string>& partitions,
+            const std::vector<std::string>& scanned, const std::vector<std::int64_t>& versions,
+            const std::map<std::string, attribute_counts>& expected_attributes, const LogCounts::deltas_type& expected_counts);
+
+        void attribute_flush_thread(std::stop_token st) {
+            while(!st.stop_requested()) {
+                {
+                    std::unique_lock lock(attribute_flush_cv_mutex);
+                    attribute_flush_cv.wait_for(lock, st, attribute_flush_interval, [this] {
+                        return attribute_stats.pending() >= attribute_flush_rows;
+                    });
+                }
+                if(st.stop_requested()) {
+                    break;
+                }
+
+                try {
+                    flush_statistics();
+                } catch(const std::exception& e) {
+                    logger->warn("Failed to flush attribute statistics, will retry: {}", e.what());
+                }
+            }
+
+            // the pool is declared before this thread, so it still runs the final flush on shutdown
+            try {
+                flush_statistics();
+            } catch(const std::exception& e) {
+                logger->error("Failed to flush attribute statistics on shutdown: {}", e.what());
+            }
+        }
+        void flush_statistics() {
+            queue_work(work_class::background, [this](pqxx::connection& conn) {
+                flush_attribute_stats(conn);
+                flush_log_counts(conn);
+            }).get();
+        }
+
         void prepare_statements(pqxx::connection& conn) {
-            conn.prepare("insert_log",
+            conn.prepare("insert_logs",
                 "INSERT INTO logs (resource, timestamp, scope, severity, attributes, body) "
-                "VALUES ($1, to_timestamp($2::double precision), $3, $4, $5::jsonb, $6::jsonb)");
-            conn.prepare("update_attribute",
+                "SELECT resource, to_timestamp(timestamp_us / 1000000.0), scope, severity, attributes, body "
+                "FROM unnest($1::integer[], $2::bigint[], $3::text[], $4::log_severity[], $5::jsonb[], $6::jsonb[]) "
+                "AS t(resource, timestamp_us, scope, severity, attributes, body) "
+                "ON CONFLICT DO NOTHING "
+                "RETURNING resource, (extract(epoch from timestamp) * 1000000)::bigint AS timestamp_us, scope");
+            conn.prepare("find_written_logs",
+                "SELECT t.index FROM unnest($1::integer[], $2::bigint[], $3::text[], $4::jsonb[], $5::jsonb[]) WITH ORDINALITY "
+                "AS t(resource, timestamp_us, scope, attributes, body, index) "
+                "JOIN logs l ON l.resource = t.resource AND l.timestamp = to_timestamp(t.timestamp_us / 1000000.0)::timestamp "
+                "AND l.scope = t.scope "
+                "WHERE l.attributes = t.attributes AND l.body = t.body");
+            conn.prepare("update_attributes",
                 "INSERT INTO log_attributes (attribute, count, count_null, count_number, count_string, count_boolean, count_array, count_object) "
-                "VALUES ($1, $2, $3, $4, $5, $6, $7, $8) "
+                "SELECT * FROM unnest($1::text[], $2::integer[], $3::integer[], $4::integer[], $5::integer[], $6::integer[], $7::integer[], $8::integer[]) "
                 "ON CONFLICT (attribute) DO UPDATE SET "
                 "count = log_attributes.count + EXCLUDED.count, "
                 "count_null = log_attributes.count_null + EXCLUDED.count_null, "
@@ -413,24 +966,72 @@ export class Database {
                 "count_boolean = log_attributes.count_boolean + EXCLUDED.count_boolean, "
                 "count_array = log_attributes.count_array + EXCLUDED.count_array, "
                 "count_object = log_attributes.count_object + EXCLUDED.count_object");
+            conn.prepare("update_log_counts",
+                "INSERT INTO log_counts (resource, scope, severity, day, count) "
+                "SELECT resource, scope, severity, DATE '1970-01-01' + day::integer, count "
+                "FROM unnest($1::integer[], $2::text[], $3::log_severity[], $4::bigint[], $5::bigint[]) "
+                "AS t(resource, scope, severity, day, count) "
+                "ON CONFLICT (resource, scope, severity, day) DO UPDATE SET "
+                "count = log_counts.count + EXCLUDED.count");
+            conn.prepare("mark_partitions_changed",
+                "INSERT INTO log_partition_changes (partition) SELECT * FROM unnest($1::text[]) "
+                "ON CONFLICT (partition) DO UPDATE SET version = log_partition_changes.version + 1");
             conn.prepare("find_resource",
-                "SELECT id FROM log_resources "
+                "SELECT id, extract(epoch from created_at) AS created_at FROM log_resources "
                 "WHERE attributes = $1::jsonb");
             conn.prepare("insert_resource",
                 "INSERT INTO log_resources (attributes) "
                 "VALUES ($1::jsonb) "
                 "ON CONFLICT (attributes) DO UPDATE SET "
                 "attributes = EXCLUDED.attributes "
-                "RETURNING id");
+                "RETURNING id, extract(epoch from created_at) AS created_at");
+            conn.prepare("get_partitions",
+                "SELECT c.relname AS name, "
+                "extract(epoch from (regexp_match(pg_get_expr(c.relpartbound, c.oid), 'FROM \\(''([^'']*)''\\)'))[1]::timestamp) AS from_s, "
+                "extract(epoch from (regexp_match(pg_get_expr(c.relpartbound, c.oid), 'TO \\(''([^'']*)''\\)'))[1]::timestamp) AS to_s "
+                "FROM pg_inherits i JOIN pg_class c ON c.oid = i.inhrelid "
+                "WHERE i.inhparent = 'logs'::regclass");
             conn.prepare("get_count",
-                "SELECT COUNT(*) FROM logs");
+                "SELECT coalesce(sum(count), 0)::bigint FROM log_counts");
             conn.prepare("get_resources",
-                "SELECT res.id AS id, extract(epoch from res.created_at) AS created_at, res.attributes AS attributes, COUNT(*) AS count "
-                "FROM log_resources res, logs WHERE id = resource GROUP BY id");
+                "SELECT id, extract(epoch from created_at) AS created_at, attributes FROM log_resources");
+            conn.prepare("get_resource",
+                "SELECT id, extract(epoch from created_at) AS created_at, attributes FROM log_resources WHERE id = $1");
+            conn.prepare("get_resource_counts",
+                "SELECT resource, sum(count)::bigint AS count FROM log_counts GROUP BY resource HAVING sum(count) > 0");
             conn.prepare("get_attributes",
-                "SELECT attribute, count FROM log_attributes");
+                "SELECT attribute, count FROM log_attributes WHERE count > 0");
             conn.prepare("get_scopes",
-                "SELECT scope, COUNT(*) as count FROM logs GROUP BY scope");
+                "SELECT scope, sum(count)::bigint AS count FROM log_counts GROUP BY scope HAVING sum(count) > 0");
+            // Log queries of the web API, one statement per combination of scope and resource filters, so each gets a plan of its own.
+            // Unset filters are passed as NULL. $7 are the projected attributes, NULL selects all of them.
+            for(bool by_scope : {false, true}) {
+                for(bool by_resource : {false, true}) {
+                    std::string name = "query_logs";
+                    std::string query =
+                        "SELECT resource, extract(epoch from timestamp) AS unix_time, scope, severity, body, "
+                        "CASE WHEN $7::text[] IS NULL THEN attributes ELSE "
+                        "(SELECT coalesce(jsonb_object_agg(key, value), '{}'::jsonb) FROM jsonb_each(attributes) WHERE key = ANY($7::text[])) "
+                        "END AS attributes "
+                        "FROM logs "
+                        "WHERE timestamp >= coalesce(to_timestamp($1::double precision), '-infinity') "
+                        "AND timestamp <= coalesce(to_timestamp($2::double precision), 'infinity') "
+                        "AND ($3::log_severity IS NULL OR severity >= $3::log_severity) "
+                        "AND timestamp <= coalesce(to_timestamp($4::bigint / 1000000.0), 'infinity') "
+                        "AND (timestamp, resource, scope) < (coalesce(to_timestamp($4::bigint / 1000000.0), 'infinity'), coalesce($5::integer, 0), coalesce($6::text, ''))";
+                    unsigned int next_parameter = 10;
+                    if(by_scope) {
+                        name += "_by_scope";
+                        query += std::format(" AND scope = ANY(${}::text[])", next_parameter++);
+                    }
+                    if(by_resource) {
+                        name += "_by_resource";
+                        query += std::format(" AND resource = ANY(${}::integer[])", next_parameter++);
+                    }
+                    query += " ORDER BY timestamp DESC, resource DESC, scope DESC LIMIT $8 OFFSET $9";
+                    conn.prepare(name, query);
+                }
+            }
             conn.prepare("get_cleanup_rules",
                 "SELECT id, name, description, enabled, extract(epoch from execution_interval) AS execution_interval_s, "
                 "extract(epoch from filter_minimum_age) AS filter_minimum_age_s, "
@@ -457,7 +1058,8 @@ export class Database {
                 "filter_resources = $6, filter_resources_type = $7, filter_scopes = $8, filter_scopes_type = $9, "
                 "filter_severities = $10, filter_severities_type = $11, filter_attributes = $12, filter_attributes_type = $13, "
                 "filter_attribute_values = $14::jsonb, filter_attribute_values_type = $15, "
-                "action = $16, action_options = $17::jsonb, updated_at = now() "
+                "action = $16, action_options = $17::jsonb, updated_at = now(), "
+                "progress_timestamp = NULL, progress_resource = NULL, progress_scope = NULL " // the filters might have changed
                 "WHERE id = $18 "
                 "RETURNING id, extract(epoch from created_at) AS created_at_s, extract(epoch from updated_at) AS updated_at_s, extract(epoch from last_execution) AS last_execution_s");
             conn.prepare("delete_cleanup_rule",
@@ -473,9 +1075,11 @@ export class Database {
                 "extract(epoch from created_at) AS created_at_s, extract(epoch from updated_at) AS updated_at_s, "
                 "extract(epoch from last_alert) AS last_alert_s, last_alert_successful, last_alert_message "
                 "FROM alert_rules");
-            conn.prepare("update_alert_result",
-                "UPDATE alert_rules SET last_alert = now(), last_alert_successful = $2, last_alert_message = $3 "
-                "WHERE id = $1");
+            conn.prepare("update_alert_results",
+                "UPDATE alert_rules SET last_alert = to_timestamp(r.time_us / 1000000.0), "
+                "last_alert_successful = r.message IS NULL, last_alert_message = r.message "
+                "FROM unnest($1::integer[], $2::text[], $3::bigint[]) AS r(id, message, time_us) "
+                "WHERE alert_rules.id = r.id");
             conn.prepare("insert_alert_rule",
                 "INSERT INTO alert_rules (name, description, enabled, notification_provider, notification_options, "
                 "filter_resources, filter_resources_type, filter_scopes, filter_scopes_type, "
@@ -495,97 +1099,75 @@ export class Database {
                 "extract(epoch from last_alert) AS last_alert_s, last_alert_successful, last_alert_message");
             conn.prepare("delete_alert_rule",
                 "DELETE FROM alert_rules WHERE id = $1");
+            conn.prepare("get_ingest_rules",
+                "SELECT id, name, description, enabled, "
+                "filter_resources, filter_resources_type, "
+                "filter_scopes, filter_scopes_type, "
+                "filter_severities, filter_severities_type, "
+                "filter_attributes, filter_attributes_type, "
+                "filter_attribute_values, filter_attribute_values_type, "
+                "action, sample_rate, transform_actions, "
+                "extract(epoch from created_at) AS created_at_s, extract(epoch from updated_at) AS updated_at_s "
+                "FROM ingest_rules");
+            conn.prepare("insert_ingest_rule",
+                "INSERT INTO ingest_rules (name, description, enabled, action, sample_rate, transform_actions, "
+                "filter_resources, filter_resources_type, filter_scopes, filter_scopes_type, "
+                "filter_severities, filter_severities_type, filter_attributes, filter_attributes_type, "
+                "filter_attribute_values, filter_attribute_values_type) "
+                "VALUES ($1, $2, $3, $4, $5, $6::jsonb, "
+                "$7, $8, $9, $10, $11, $12, $13, $14, $15::jsonb, $16) "
+                "RETURNING id, extract(epoch from created_at) AS created_at_s, extract(epoch from updated_at) AS updated_at_s");
+            conn.prepare("update_ingest_rule",
+                "UPDATE ingest_rules SET name = $1, description = $2, enabled = $3, "
+                "action = $4, sample_rate = $5, transform_actions = $6::jsonb, "
+                "filter_resources = $7, filter_resources_type = $8, filter_scopes = $9, filter_scopes_type = $10, "
+                "filter_severities = $11, filter_severities_type = $12, filter_attributes = $13, filter_attributes_type = $14, "
+                "filter_attribute_values = $15::jsonb, filter_attribute_values_type = $16, updated_at = now() "
+                "WHERE id = $17 "
+                "RETURNING id, extract(epoch from created_at) AS created_at_s, extract(epoch from updated_at) AS updated_at_s");
+            conn.prepare("delete_ingest_rule",
+                "DELETE FROM ingest_rules WHERE id = $1");
             conn.prepare("complete_cleanup_rule",
-                "UPDATE cleanup_rules SET last_execution = NOW() WHERE id = $1");
-            conn.prepare("update_log_attributes",
-                "UPDATE logs SET attributes = $4::jsonb WHERE resource = $1 AND timestamp = to_timestamp($2::double precision) AND scope = $3");
+                "UPDATE cleanup_rules SET last_execution = NOW(), "
+                "progress_timestamp = NULL, progress_resource = NULL, progress_scope = NULL WHERE id = $1");
+            conn.prepare("get_cleanup_progress",
+                "SELECT progress_timestamp::text AS timestamp, progress_resource AS resource, progress_scope AS scope "
+                "FROM cleanup_rules WHERE id = $1 AND progress_timestamp IS NOT NULL");
+            conn.prepare("update_cleanup_progress",
+                "UPDATE cleanup_rules SET progress_timestamp = $2::timestamp, progress_resource = $3, progress_scope = $4 WHERE id = $1");
         }
 
-        void reconnect(int index, pqxx::connection& conn, unsigned int attempt = 0, unsigned int max_attempts = 5) {
-            try {
-                logger->info("Reconnecting to database (conneciton {}, attempt {})...", index, attempt+1);
-                if(conn.is_open()) {
-                    conn.close();
-                }
-                conn = pqxx::connection(connection_string);
-                conn.set_session_var("application_name", std::format("backend-worker-{}", index));
-                prepare_statements(conn);
-                logger->info("Reconnected to database (connection {}, attempt {})", index, attempt+1);
-                return;
-            } catch(const std::exception& e) {
-                logger->error("Failed to reconnect to database (connection {}, attempt {}): {}", index, attempt+1, e.what());
-            } catch(...) {
-                logger->error("Failed to reconnect to database (connection {}, attempt {})", index, attempt+1);
-            }
-
-            if(attempt < max_attempts) {
-                std::chrono::seconds backoff{1<<attempt};
-                logger->info("Reconnecting in {} seconds...", backoff.count());
-                std::this_thread::sleep_for(backoff);
-                reconnect(index, conn, attempt + 1, max_attempts);
-            } else {
-                logger->critical("Failed to reconnect to database (connection {}) after {} attempts", index, max_attempts);
-                std::terminate();
-            }
-        }
-
-        void worker(unsigned int id, pqxx::connection& conn, std::stop_token st) {
-            logger->debug("Worker {} started", id);
-            prepare_statements(conn);
-
-            while(!st.stop_requested()) {
-                // first of all, make sure we receive notifications
-                conn.get_notifs();
-
-                std::move_only_function<void(pqxx::connection&)> work;
-                std::promise<void> promise;
-                {
-                    std::unique_lock lock(mutex);
+        std::string connection_string;
+        std::shared_ptr<spdlog::logger> logger;
+        std::mutex mutex; // guards the admission limit
+        std::size_t max_queue_size = default_max_queue_size;
+        std::uint64_t rejected_work = 0;
 
-                    // timeout, so we will check for notifications, even if we don't have work
-                    bool has_work = cv.wait_for(lock, st, std::chrono::seconds(10), [this] {
-                        return !queue.empty();
-                    });
-                    if(st.stop_requested()) {
-                        break;
-                    }
-                    if(!has_work) {
-                        continue;
-                    }
+        ResourceRegistry resource_registry;
+        PartitionSet partition_set;
+        partition_granularity granularity = partition_granularity::daily;
+        std::mutex partition_mutex;
 
-                    work = std::move(queue.front().first);
-                    promise = std::move(queue.front().second);
-                    queue.pop_front();
-                }
+        constexpr static auto attribute_flush_interval = std::chrono::milliseconds(1000);
+        constexpr static std::size_t attribute_flush_rows = 10000;
+        AttributeStats attribute_stats;
+        std::mutex attribute_flush_mutex; // serializes flushes with consistency checks
+        std::mutex attribute_flush_cv_mutex;
+        std::condition_variable_any attribute_flush_cv;
+        LogCounts log_counts; // flushed together with the attribute statistics
+        std::shared_mutex statistics_commit_mutex; // held shared while committing logs and recording their deltas
+        std::mutex changed_partitions_mutex;
+        std::set<std::string> changed_partitions; // marked by committed ingest since the last consistency snapshot
 
-                try {
-                    work(conn);
-                    promise.set_value();
-                } catch(const pqxx::failure& failure) {
-                    logger->error("pqxx failure in worker {}: {}", id, failure.what());
-                    promise.set_exception(std::current_exception());
-
-                    if(failure.poisons_connection()) {
-                        logger->error("Connection of worker {} is poisoned. Reconnecting...");
-                        reconnect(id, conn);
-                    }
-                } catch(const std::exception& ex) {
-                    logger->error("Unhandled exception in worker {}: {}", id, ex.what());
-                    promise.set_exception(std::current_exception());
-                } catch(...) {
-                    logger->error("Unhandled unknown exception in worker {}", id);
-                    promise.set_exception(std::current_exception());
-                }
-            }
-        }
+        std::mutex consistency_mutex;
+        std::condition_variable_any consistency_cv;
+        bool consistency_requested = false;
 
-        std::string connection_string;
-        std::shared_ptr<spdlog::logger> logger;
-        std::vector<pqxx::connection> connections;
-        std::vector<std::jthread> threads;
-        std::mutex mutex;
-        std::condition_variable_any cv;
-        std::deque<std::pair<std::move_only_function<void(pqxx::connection&)>, std::promise<void>>> queue;
+        // declared last, so they are stopped before anything they use is destroyed
+        Listener listener;
+        ConnectionPool pool;
+        std::jthread attribute_flusher;
+        std::jthread consistency_checker;
 };
 
 }
@@ -0,0 +1,138 @@
+module;
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <future>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+export module backend.database:listener;
+
+import pqxx;
+import spdlog;
+
+namespace backend::database {
+
+// Receives LISTEN/NOTIFY notifications on a connection of its own, so the workers do not have to poll for them.
+// Handlers run on the listener thread and may use the connection of the notification for queries.
+// Before start is called, the connection can be used for setup work like migrations, so it is only set up
+// (e.g. with prepared statements) once the listener starts.
+// Notifications sent while the connection is down are lost, so after reconnecting every handler is called once with an
+// empty payload, on which it has to reload everything it keeps track of.
+export class Listener {
+    public:
+        using handler_type = std::function<void(pqxx::notification)>;
+        using setup_type = std::function<void(pqxx::connection&)>;
+
+        Listener(std::string connection_string, setup_type setup, std::shared_ptr<spdlog::logger> logger)
+            : connection_string(std::move(connection_string)), setup(std::move(setup)), logger(std::move(logger)), conn(connect())
+        {
+        }
+        Listener(const Listener&) = delete;
+        Listener& operator=(const Listener&) = delete;
+
+        pqxx::connection& connection() {
+            return conn;
+        }
+
+        void start() {
+            setup(conn);
+            thread = std::jthread(std::bind(&Listener::listener_thread, this, std::placeholders::_1));
+            pthread_setname_np(thread.native_handle(), "db-listener");
+        }
+
+        // Blocks until the channel is listened to, so no notification sent after this returns is missed. Must be called after start.
+        void listen(std::string channel, handler_type handler) {
+            std::future<void> done;
+            {
+                std::unique_lock lock(mutex);
+                auto& registration = pending.emplace_back(std::move(channel), std::move(handler), std::promise<void>{});
+                done = std::get<2>(registration).get_future();
+            }
+            done.get();
+        }
+    private:
+        constexpr static auto poll_interval = std::chrono::seconds(1); // upper bound for how long listen blocks
+
+        pqxx::connection connect() {
+            pqxx::connection c(connection_string);
+            c.set_session_var("application_name", "backend-listener");
+            return c;
+        }
+
+        void apply_pending() {
+            std::vector<std::tuple<std::string, handler_type, std::promise<void>>> registrations;
+            {
+                std::unique_lock lock(mutex);
+                registrations.swap(pending);
+            }
+            for(auto& [channel, handler, promise] : registrations) {
+                try {
+                    conn.listen(channel, handler);
+                    handlers.insert_or_assign(channel, std::move(handler));
+                    promise.set_value();
+                } catch(...) {
+                    promise.set_exception(std::current_exception());
+                }
+            }
+        }
+
+        void listener_thread(std::stop_token st) {
+            auto backoff = std::chrono::seconds(1);
+            while(!st.stop_requested()) {
+                try {
+                    apply_pending();
+                    conn.await_notification(std::chrono::duration_cast<std::chrono::seconds>(poll_interval).count(), 0);
+                    backoff = std::chrono::seconds(1);
+                } catch(const pqxx::broken_connection& e) {
+                    logger->error("Lost listener connection: {}", e.what());
+                    std::this_thread::sleep_for(backoff);
+                    backoff = std::min(backoff * 2, std::chrono::seconds(30));
+                    reconnect();
+                } catch(const std::exception& e) {
+                    logger->error("Error while waiting for notifications: {}", e.what());
+                }
+            }
+        }
+
+        // Listens again before resyncing, so nothing sent in between is missed.
+        void reconnect() {
+            try {
+                conn = connect();
+                setup(conn);
+                for(const auto& [channel, handler] : handlers) {
+                    conn.listen(channel, handler);
+                }
+                logger->info("Reconnected listener connection and listened to {} channel(s) again", handlers.size());
+            } catch(const std::exception& e) {
+                logger->error("Failed to reconnect listener connection: {}", e.what());
+                return;
+            }
+            for(const auto& [channel, handler] : handlers) {
+                try {
+                    handler(pqxx::notification{conn, channel, "", 0});
+                } catch(const std::exception& e) {
+                    logger->error("Failed to resync {} after reconnecting: {}", channel, e.what());
+                }
+            }
+        }
+
+        std::string connection_string;
+        setup_type setup;
+        std::shared_ptr<spdlog::logger> logger;
+        pqxx::connection conn;
+        std::map<std::string, handler_type> handlers; // only used by the listener thread
+
+        std::mutex mutex;
+        std::vector<std::tuple<std::string, handler_type, std::promise<void>>> pending;
+
+        std::jthread thread; // declared last, so it is stopped before anything it uses is destroyed
+};
+
+}
@@ -0,0 +1,58 @@
+module;
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+
+export module backend.database:log_counts;
+
+import common;
+
+namespace backend::database {
+
+// A row of the log_counts table
+export struct log_count_key {
+    unsigned int resource;
+    std::string scope;
+    common::log_severity severity;
+    std::chrono::sys_days day;
+
+    auto operator<=>(const log_count_key&) const = default;
+};
+
+// Accumulates count deltas for the log_counts table in memory, like AttributeStats does for log_attributes.
+// A batch of logs usually touches only a handful of keys, so callers merge their deltas first and a single mutex is enough.
+export class LogCounts {
+    public:
+        using deltas_type = std::map<log_count_key, std::int64_t>;
+
+        void add(const deltas_type& deltas) {
+            std::unique_lock lock(mutex);
+            for(const auto& [key, delta] : deltas) {
+                counts[key] += delta;
+            }
+        }
+
+        // Removes all accumulated deltas. The result is sorted, so applying it always locks rows in the same order.
+        deltas_type take() {
+            deltas_type result;
+            std::unique_lock lock(mutex);
+            result.swap(counts);
+            return result;
+        }
+        // Puts deltas back, e.g. after applying them to the database failed.
+        void restore(const deltas_type& deltas) {
+            add(deltas);
+        }
+        // Returns a copy of all accumulated deltas and leaves them in place.
+        deltas_type peek() {
+            std::unique_lock lock(mutex);
+            return counts;
+        }
+    private:
+        std::mutex mutex;
+        deltas_type counts;
+};
+
+}
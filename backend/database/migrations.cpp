@@ -10,7 +10,7 @@ namespace backend::database {
 #include "migrations.inc"
 
 void Database::run_migrations() {
-    pqxx::work txn(connections.front());
+    pqxx::work txn(listener.connection());
     txn.exec(R"(
         CREATE TABLE IF NOT EXISTS schema_migrations (
             version INTEGER PRIMARY KEY,
@@ -0,0 +1,14 @@
+-- Number of logs per resource, scope, severity and day, so counting logs does not need a scan of all of them.
+-- Ingest adds to it in batches and cleanup jobs subtract what they delete.
+CREATE TABLE log_counts (
+    resource INTEGER NOT NULL,
+    scope TEXT NOT NULL,
+    severity log_severity NOT NULL,
+    day DATE NOT NULL,
+    count BIGINT NOT NULL,
+
+    PRIMARY KEY(resource, scope, severity, day)
+);
+
+INSERT INTO log_counts (resource, scope, severity, day, count)
+SELECT resource, scope, severity, timestamp::date, COUNT(*) FROM logs GROUP BY resource, scope, severity, timestamp::date;
@@ -0,0 +1,36 @@
+-- Attribute statistics and log counts of every partition, so the consistency check only has to rescan partitions which changed.
+-- log_attributes and log_counts are rebuilt by summing these up.
+CREATE TABLE log_partition_attributes (
+    partition TEXT NOT NULL,
+    attribute TEXT NOT NULL,
+    count INTEGER NOT NULL,
+    count_null INTEGER NOT NULL,
+    count_number INTEGER NOT NULL,
+    count_string INTEGER NOT NULL,
+    count_boolean INTEGER NOT NULL,
+    count_array INTEGER NOT NULL,
+    count_object INTEGER NOT NULL,
+
+    PRIMARY KEY(partition, attribute)
+);
+
+CREATE TABLE log_partition_counts (
+    partition TEXT NOT NULL,
+    resource INTEGER NOT NULL,
+    scope TEXT NOT NULL,
+    severity log_severity NOT NULL,
+    day DATE NOT NULL,
+    count BIGINT NOT NULL,
+
+    PRIMARY KEY(partition, resource, scope, severity, day)
+);
+
+-- The checkpoint of each partition: the number of modifications PostgreSQL had counted for it when it was scanned last.
+-- A partition whose counter differs (or was reset) is scanned again.
+CREATE TABLE log_partition_checks (
+    partition TEXT NOT NULL,
+    modifications BIGINT NOT NULL,
+    checked_at TIMESTAMP WITHOUT TIME ZONE NOT NULL DEFAULT NOW(),
+
+    PRIMARY KEY(partition)
+);
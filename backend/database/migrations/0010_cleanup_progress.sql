@@ -0,0 +1,5 @@
+-- Watermark of a cleanup run in progress: the last log it processed, in (timestamp, resource, scope) order.
+-- Cleanup jobs commit in batches and resume from here after a restart. NULL while no run is in progress.
+ALTER TABLE cleanup_rules ADD COLUMN progress_timestamp TIMESTAMP WITHOUT TIME ZONE;
+ALTER TABLE cleanup_rules ADD COLUMN progress_resource INTEGER;
+ALTER TABLE cleanup_rules ADD COLUMN progress_scope TEXT;
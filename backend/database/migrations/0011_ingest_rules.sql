@@ -0,0 +1,29 @@
+CREATE TYPE ingest_action AS ENUM (
+    'DROP', 'SAMPLE', 'TRANSFORM'
+);
+
+CREATE TABLE ingest_rules (
+    id SERIAL PRIMARY KEY,
+    name TEXT NOT NULL UNIQUE,
+    description TEXT,
+    enabled BOOLEAN NOT NULL DEFAULT TRUE,
+
+    filter_resources INTEGER[] NOT NULL DEFAULT '{}',
+    filter_resources_type filter_type NOT NULL DEFAULT 'INCLUDE',
+    filter_scopes TEXT[] NOT NULL DEFAULT '{}',
+    filter_scopes_type filter_type NOT NULL DEFAULT 'INCLUDE',
+    filter_severities log_severity[] NOT NULL DEFAULT '{}',
+    filter_severities_type filter_type NOT NULL DEFAULT 'INCLUDE',
+    filter_attributes TEXT[] NOT NULL DEFAULT '{}',
+    filter_attributes_type filter_type NOT NULL DEFAULT 'INCLUDE',
+    filter_attribute_values jsonb NOT NULL DEFAULT '{}'::jsonb CHECK (jsonb_typeof(filter_attribute_values) = 'object'),
+    filter_attribute_values_type filter_type NOT NULL DEFAULT 'INCLUDE',
+
+    "action" ingest_action NOT NULL DEFAULT 'DROP',
+    sample_rate DOUBLE PRECISION NOT NULL DEFAULT 1 CHECK (sample_rate >= 0 AND sample_rate <= 1),
+    transform_actions jsonb NOT NULL DEFAULT '[]'::jsonb CHECK (jsonb_typeof(transform_actions) = 'array'),
+
+    created_at TIMESTAMP DEFAULT CURRENT_TIMESTAMP,
+    updated_at TIMESTAMP DEFAULT CURRENT_TIMESTAMP
+);
+CREATE INDEX ingest_rules_name_index ON ingest_rules (name);
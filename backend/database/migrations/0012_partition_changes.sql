@@ -0,0 +1,13 @@
+-- Partitions whose logs were written or deleted since they were scanned last, marked by the backend in the same transaction.
+-- They replace the modification counters of pg_stat_user_tables, which lag behind and can be lost.
+-- Marking a partition again bumps its version, so a check only unmarks it if nothing changed it after its snapshot.
+CREATE TABLE log_partition_changes (
+    partition TEXT NOT NULL,
+    version BIGINT NOT NULL DEFAULT 1,
+
+    PRIMARY KEY(partition)
+);
+
+-- nothing tells which partitions changed since their last check, so all of them are scanned once more
+INSERT INTO log_partition_changes (partition) SELECT partition FROM log_partition_checks;
+ALTER TABLE log_partition_checks DROP COLUMN modifications;
@@ -0,0 +1,149 @@
+module;
+#include <array>
+#include <chrono>
+#include <format>
+#include <iterator>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+export module backend.database:partitions;
+
+namespace backend::database {
+
+export enum class partition_granularity {
+    hourly, daily, weekly
+};
+export constexpr std::array partition_granularity_names = {
+    "hourly", "daily", "weekly"
+};
+export std::optional<partition_granularity> parse_partition_granularity(std::string_view name) {
+    for(std::size_t i = 0; i < partition_granularity_names.size(); i++) {
+        if(name == partition_granularity_names[i]) {
+            return static_cast<partition_granularity>(i);
+        }
+    }
+    return std::nullopt;
+}
+
+export struct partition_range {
+    std::string name;
+    std::chrono::sys_seconds from;
+    std::chrono::sys_seconds to;
+
+    bool contains(std::chrono::sys_seconds timestamp) const {
+        return from <= timestamp && timestamp < to;
+    }
+};
+
+// Known partitions of the logs table, so ingest can tell whether a partition exists without asking the database.
+export class PartitionSet {
+    public:
+        bool contains(std::chrono::sys_seconds timestamp) const {
+            std::shared_lock lock(mutex);
+            return find_locked(timestamp) != nullptr;
+        }
+        std::optional<std::string> name_of(std::chrono::sys_seconds timestamp) const {
+            std::shared_lock lock(mutex);
+            const partition_range* range = find_locked(timestamp);
+            return range ? std::optional{range->name} : std::nullopt;
+        }
+        std::vector<partition_range> ranges() const {
+            std::shared_lock lock(mutex);
+            std::vector<partition_range> result;
+            result.reserve(partitions.size());
+            for(const auto& [_, range] : partitions) {
+                result.push_back(range);
+            }
+            return result;
+        }
+
+        void insert(partition_range range) {
+            std::unique_lock lock(mutex);
+            auto from = range.from;
+            partitions.insert_or_assign(from, std::move(range));
+        }
+        void erase(std::string_view name) {
+            std::unique_lock lock(mutex);
+            std::erase_if(partitions, [name](const auto& entry) { return entry.second.name == name; });
+        }
+        void replace(std::vector<partition_range> ranges) {
+            std::unique_lock lock(mutex);
+            partitions.clear();
+            for(auto& range : ranges) {
+                auto from = range.from;
+                partitions.insert_or_assign(from, std::move(range));
+            }
+        }
+
+        // Computes the partition that should be created for the given timestamp.
+        // The range is aligned to the granularity, but clipped to not overlap any known partition.
+        partition_range plan(std::chrono::sys_seconds timestamp, partition_granularity granularity) const {
+            using namespace std::chrono;
+
+            sys_seconds from{}, to{};
+            switch(granularity) {
+                case partition_granularity::hourly:
+                    from = floor<hours>(timestamp);
+                    to = from + hours{1};
+                    break;
+                case partition_granularity::daily:
+                    from = floor<days>(timestamp);
+                    to = from + days{1};
+                    break;
+                case partition_granularity::weekly: {
+                    sys_days day = floor<days>(timestamp);
+                    from = day - (weekday{day} - Monday);
+                    to = from + weeks{1};
+                    break;
+                }
+            }
+            auto aligned_from = from;
+
+            {
+                std::shared_lock lock(mutex);
+                auto next = partitions.upper_bound(timestamp);
+                if(next != partitions.end() && next->second.from < to) {
+                    to = next->second.from;
+                }
+                if(next != partitions.begin()) {
+                    const auto& previous = std::prev(next)->second;
+                    if(previous.to > from) {
+                        from = previous.to;
+                    }
+                }
+            }
+
+            year_month_day ymd{floor<days>(from)};
+            std::string name = std::format("logs_{:04}{:02}{:02}",
+                static_cast<int>(ymd.year()), static_cast<unsigned int>(ymd.month()), static_cast<unsigned int>(ymd.day()));
+            if(granularity == partition_granularity::hourly) {
+                name += std::format("_{:02}", hh_mm_ss{from - floor<days>(from)}.hours().count());
+            } else if(granularity == partition_granularity::weekly) {
+                name += "_w";
+            }
+            if(from != aligned_from) {
+                hh_mm_ss time{from - floor<days>(from)};
+                name += std::format("_{:02}{:02}{:02}", time.hours().count(), time.minutes().count(), time.seconds().count());
+            }
+            return partition_range{std::move(name), from, to};
+        }
+    private:
+        const partition_range* find_locked(std::chrono::sys_seconds timestamp) const {
+            auto it = partitions.upper_bound(timestamp);
+            if(it == partitions.begin()) {
+                return nullptr;
+            }
+            const auto& range = std::prev(it)->second;
+            return range.contains(timestamp) ? &range : nullptr;
+        }
+
+        mutable std::shared_mutex mutex;
+        std::map<std::chrono::sys_seconds, partition_range> partitions; // keyed by lower bound
+};
+
+}
@@ -0,0 +1,429 @@
+module;
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <format>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <shared_mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+export module backend.database:pool;
+
+import pqxx;
+import spdlog;
+
+namespace backend::database {
+
+// Kinds of database work, in order of priority. Each class has a worker reserved for it, so long running exports
+// or cleanup jobs cannot hold up ingestion and the other way round.
+export enum class work_class : std::size_t {
+    ingest,      // inserting logs
+    interactive, // requests from the web interface
+    background,  // jobs and other periodic maintenance
+};
+export constexpr std::size_t work_class_count = 3;
+
+export struct pool_options {
+    constexpr static unsigned int default_min_connections = 6;
+    constexpr static unsigned int default_max_connections = 16;
+
+    unsigned int min_connections = default_min_connections;
+    unsigned int max_connections = default_max_connections;
+    std::chrono::milliseconds grow_after{50}; // how long work may wait before another connection is opened
+    std::chrono::seconds idle_timeout{60};    // how long a connection above the minimum may be idle before it is closed
+};
+
+// Worker threads with one database connection each. Every worker has its own queue, and idle workers steal work
+// from the others, so submitting work does not make all workers contend on one lock.
+// The pool grows while work waits longer than grow_after and no worker is idle, and shrinks back to the minimum
+// once connections were idle for idle_timeout. If there are more than work_class_count connections, the first ones
+// are reserved for one class each and are never closed.
+export class ConnectionPool {
+    public:
+        using work_type = std::move_only_function<void(pqxx::connection&)>;
+        using setup_type = std::function<void(pqxx::connection&)>;
+
+        ConnectionPool(std::string connection_string, pool_options options, setup_type setup, std::shared_ptr<spdlog::logger> logger)
+            : connection_string(std::move(connection_string)), options(options), setup(std::move(setup)), logger(std::move(logger))
+        {
+            this->options.min_connections = std::max(this->options.min_connections, 1u);
+            this->options.max_connections = std::max(this->options.max_connections, this->options.min_connections);
+            reserve_workers = this->options.min_connections > work_class_count;
+        }
+        ~ConnectionPool() {
+            scaler = std::jthread{};
+            std::vector<std::unique_ptr<worker_state>> stopping;
+            {
+                std::unique_lock lock(workers_mutex);
+                stopping.swap(workers);
+            }
+            for(auto& w : stopping) {
+                w->thread.request_stop();
+            }
+            for(auto& w : stopping) {
+                w->thread = std::jthread{};
+            }
+        }
+        ConnectionPool(const ConnectionPool&) = delete;
+        ConnectionPool& operator=(const ConnectionPool&) = delete;
+
+        void start() {
+            for(unsigned int i = 0; i < options.min_connections; i++) {
+                add_worker();
+            }
+            scaler = std::jthread(std::bind(&ConnectionPool::scaler_thread, this, std::placeholders::_1));
+            pthread_setname_np(scaler.native_handle(), "db-pool");
+            logger->info("Started connection pool with {} to {} connection(s)", options.min_connections, options.max_connections);
+        }
+
+        std::future<void> submit(work_class cls, work_type&& work) {
+            job j{std::move(work), {}, std::chrono::steady_clock::now()};
+            auto future = j.promise.get_future();
+
+            std::shared_lock lock(workers_mutex);
+            worker_state* target = pick_worker(cls);
+            if(!target) {
+                throw std::logic_error("Connection pool has not been started");
+            }
+            {
+                std::unique_lock worker_lock(target->mutex);
+                target->queues[std::to_underlying(cls)].push_back(std::move(j));
+                target->queued++;
+            }
+            queued_count[std::to_underlying(cls)]++;
+            target->cv.notify_one();
+            return future;
+        }
+
+        std::size_t queued(work_class cls) const {
+            return queued_count[std::to_underlying(cls)];
+        }
+        std::size_t size() const {
+            std::shared_lock lock(workers_mutex);
+            return workers.size();
+        }
+    private:
+        constexpr static auto scale_interval = std::chrono::milliseconds(100);
+
+        struct job {
+            work_type work;
+            std::promise<void> promise;
+            std::chrono::steady_clock::time_point queued_at;
+        };
+        struct worker_state {
+            worker_state(unsigned int id, std::optional<work_class> reserved, pqxx::connection&& conn)
+                : id(id), reserved(reserved), conn(std::move(conn)) {}
+
+            unsigned int id;
+            std::optional<work_class> reserved;
+            pqxx::connection conn;
+
+            std::mutex mutex;
+            std::condition_variable_any cv;
+            std::array<std::deque<job>, work_class_count> queues;
+            std::atomic<std::size_t> queued = 0;
+            std::atomic<bool> idle = false;
+            bool wake = false; // asked to look for work to steal
+            std::chrono::steady_clock::time_point idle_since;
+
+            std::jthread thread; // declared last, so it is stopped before anything it uses is destroyed
+        };
+
+        pqxx::connection connect(unsigned int id) {
+            pqxx::connection conn(connection_string);
+            conn.set_session_var("application_name", std::format("backend-worker-{}", id));
+            setup(conn);
+            return conn;
+        }
+
+        void add_worker() {
+            unsigned int id = next_id++;
+            std::optional<work_class> reserved;
+            if(reserve_workers && id < work_class_count) {
+                reserved = static_cast<work_class>(id);
+            }
+            auto w = std::make_unique<worker_state>(id, reserved, connect(id));
+
+            std::unique_lock lock(workers_mutex);
+            auto* state = workers.emplace_back(std::move(w)).get();
+            workers_count = workers.size();
+            state->thread = std::jthread(std::bind(&ConnectionPool::worker_thread, this, std::placeholders::_1, state));
+            pthread_setname_np(state->thread.native_handle(), std::format("db-worker-{}", id).c_str());
+            logger->debug("Opened connection {}{}, pool has {} connection(s)", id,
+                reserved ? std::format(" (reserved for class {})", std::to_underlying(*reserved)) : "", workers.size());
+        }
+
+        static bool eligible(const worker_state& w, work_class cls) {
+            return !w.reserved || *w.reserved == cls;
+        }
+
+        // Prefers an idle worker, otherwise the one with the shortest queue. Must be called with workers_mutex held.
+        worker_state* pick_worker(work_class cls) {
+            worker_state* best = nullptr;
+            for(auto& w : workers) {
+                if(!eligible(*w, cls)) {
+                    continue;
+                }
+                if(w->idle && w->queued == 0) {
+                    return w.get();
+                }
+                if(!best || w->queued < best->queued) {
+                    best = w.get();
+                }
+            }
+            return best;
+        }
+
+        // At most half of the shared workers may be busy with work other than ingest at once.
+        std::size_t shared_limit() const {
+            std::size_t shared = workers_count - (reserve_workers ? work_class_count : 0);
+            return std::max<std::size_t>(1, shared / 2);
+        }
+        bool acquire_slot(const worker_state& self, work_class cls) {
+            if(self.reserved || cls == work_class::ingest) {
+                return true;
+            }
+            if(shared_busy_other.fetch_add(1) >= shared_limit()) {
+                shared_busy_other--;
+                return false;
+            }
+            return true;
+        }
+        void release_slot(const worker_state& self, work_class cls) {
+            if(self.reserved || cls == work_class::ingest) {
+                return;
+            }
+            shared_busy_other--;
+            wake_idle(); // other work might have been waiting for the slot
+        }
+
+        // Takes the next job self may run from the queues of from. Must be called with the mutex of from held.
+        std::optional<std::pair<work_class, job>> take(worker_state& self, worker_state& from) {
+            for(std::size_t i = 0; i < work_class_count; i++) {
+                auto cls = static_cast<work_class>(i);
+                auto& queue = from.queues[i];
+                if(queue.empty() || !eligible(self, cls) || !acquire_slot(self, cls)) {
+                    continue;
+                }
+                job j = std::move(queue.front());
+                queue.pop_front();
+                from.queued--;
+                queued_count[i]--;
+                return std::pair{cls, std::move(j)};
+            }
+            return std::nullopt;
+        }
+        // Must be called with the mutex of self held.
+        bool has_work(const worker_state& self) const {
+            for(std::size_t i = 0; i < work_class_count; i++) {
+                auto cls = static_cast<work_class>(i);
+                if(!self.queues[i].empty() && eligible(self, cls)
+                    && (self.reserved || cls == work_class::ingest || shared_busy_other < shared_limit()))
+                {
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        std::optional<std::pair<work_class, job>> steal(worker_state& self) {
+            std::shared_lock lock(workers_mutex);
+            for(auto& w : workers) {
+                if(w.get() == &self || w->queued == 0) {
+                    continue;
+                }
+                std::unique_lock worker_lock(w->mutex);
+                if(auto stolen = take(self, *w)) {
+                    return stolen;
+                }
+            }
+            return std::nullopt;
+        }
+
+        void wake_idle() {
+            std::shared_lock lock(workers_mutex);
+            for(auto& w : workers) {
+                if(w->idle) {
+                    {
+                        std::unique_lock worker_lock(w->mutex);
+                        w->wake = true;
+                    }
+                    w->cv.notify_one();
+                }
+            }
+        }
+
+        void worker_thread(std::stop_token st, worker_state* self) {
+            while(!st.stop_requested()) {
+                std::optional<std::pair<work_class, job>> next;
+                {
+                    std::unique_lock lock(self->mutex);
+                    next = take(*self, *self);
+                }
+                if(!next) {
+                    next = steal(*self);
+                }
+                if(!next) {
+                    std::unique_lock lock(self->mutex);
+                    self->idle = true;
+                    self->idle_since = std::chrono::steady_clock::now();
+                    self->cv.wait(lock, st, [&] { return self->wake || has_work(*self); });
+                    self->wake = false;
+                    self->idle = false;
+                    continue;
+                }
+
+                auto& [cls, j] = *next;
+                try {
+                    j.work(self->conn);
+                    release_slot(*self, cls);
+                    j.promise.set_value();
+                } catch(const pqxx::failure& failure) {
+                    logger->error("pqxx failure in worker {}: {}", self->id, failure.what());
+                    release_slot(*self, cls);
+                    j.promise.set_exception(std::current_exception());
+
+                    if(failure.poisons_connection()) {
+                        logger->error("Connection of worker {} is poisoned. Reconnecting...", self->id);
+                        reconnect(*self);
+                    }
+                } catch(const std::exception& ex) {
+                    logger->error("Unhandled exception in worker {}: {}", self->id, ex.what());
+                    release_slot(*self, cls);
+                    j.promise.set_exception(std::current_exception());
+                } catch(...) {
+                    logger->error("Unhandled unknown exception in worker {}", self->id);
+                    release_slot(*self, cls);
+                    j.promise.set_exception(std::current_exception());
+                }
+            }
+        }
+
+        void reconnect(worker_state& w, unsigned int attempt = 0, unsigned int max_attempts = 5) {
+            try {
+                logger->info("Reconnecting to database (connection {}, attempt {})...", w.id, attempt+1);
+                if(w.conn.is_open()) {
+                    w.conn.close();
+                }
+                w.conn = connect(w.id);
+                logger->info("Reconnected to database (connection {}, attempt {})", w.id, attempt+1);
+                return;
+            } catch(const std::exception& e) {
+                logger->error("Failed to reconnect to database (connection {}, attempt {}): {}", w.id, attempt+1, e.what());
+            } catch(...) {
+                logger->error("Failed to reconnect to database (connection {}, attempt {})", w.id, attempt+1);
+            }
+
+            if(attempt < max_attempts) {
+                std::chrono::seconds backoff{1<<attempt};
+                logger->info("Reconnecting in {} seconds...", backoff.count());
+                std::this_thread::sleep_for(backoff);
+                reconnect(w, attempt + 1, max_attempts);
+            } else {
+                logger->critical("Failed to reconnect to database (connection {}) after {} attempts", w.id, max_attempts);
+                std::terminate();
+            }
+        }
+
+        void scaler_thread(std::stop_token st) {
+            std::mutex scaler_mutex;
+            std::condition_variable_any scaler_cv;
+            while(!st.stop_requested()) {
+                {
+                    std::unique_lock lock(scaler_mutex);
+                    // only woken up early to stop
+                    scaler_cv.wait_for(lock, st, scale_interval, [] { return false; });
+                }
+                if(st.stop_requested()) {
+                    break;
+                }
+
+                try {
+                    scale();
+                } catch(const std::exception& e) {
+                    logger->error("Failed to resize connection pool: {}", e.what());
+                }
+            }
+        }
+
+        void scale() {
+            auto now = std::chrono::steady_clock::now();
+            std::chrono::steady_clock::duration longest_wait{};
+            std::size_t idle = 0, size = 0;
+            worker_state* retire = nullptr;
+            {
+                std::shared_lock lock(workers_mutex);
+                size = workers.size();
+                for(auto& w : workers) {
+                    std::unique_lock worker_lock(w->mutex);
+                    for(const auto& queue : w->queues) {
+                        if(!queue.empty()) {
+                            longest_wait = std::max(longest_wait, now - queue.front().queued_at);
+                        }
+                    }
+                    if(w->idle) {
+                        idle++;
+                        if(!retire && !w->reserved && w->queued == 0 && now - w->idle_since >= options.idle_timeout) {
+                            retire = w.get();
+                        }
+                    }
+                }
+            }
+
+            if(longest_wait >= options.grow_after) {
+                // idle workers can steal the waiting work, unless they may not take its class
+                if(idle > 0 && longest_wait < 2 * options.grow_after) {
+                    wake_idle();
+                } else if(size < options.max_connections) {
+                    add_worker();
+                }
+                return;
+            }
+
+            if(retire && size > options.min_connections) {
+                std::unique_ptr<worker_state> removed;
+                {
+                    std::unique_lock lock(workers_mutex);
+                    std::unique_lock worker_lock(retire->mutex);
+                    if(!retire->idle || retire->queued != 0) {
+                        return; // got work in the meantime
+                    }
+                    auto it = std::ranges::find_if(workers, [&](const auto& w) { return w.get() == retire; });
+                    removed = std::move(*it);
+                    workers.erase(it);
+                    workers_count = workers.size();
+                }
+                removed->thread = std::jthread{}; // stops and joins
+                logger->debug("Closed idle connection {}, pool has {} connection(s)", removed->id, size - 1);
+            }
+        }
+
+        std::string connection_string;
+        pool_options options;
+        setup_type setup;
+        std::shared_ptr<spdlog::logger> logger;
+        bool reserve_workers = false;
+
+        mutable std::shared_mutex workers_mutex; // guards the list of workers, not their queues
+        std::vector<std::unique_ptr<worker_state>> workers;
+        std::atomic<std::size_t> workers_count = 0;
+        unsigned int next_id = 0;
+        std::array<std::atomic<std::size_t>, work_class_count> queued_count{};
+        std::atomic<std::size_t> shared_busy_other = 0; // shared workers busy with work other than ingest
+
+        std::jthread scaler; // declared last, so it is stopped before anything it uses is destroyed
+};
+
+}
@@ -0,0 +1,67 @@
+module;
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <shared_mutex>
+#include <string>
+#include <unordered_map>
+
+export module backend.database:resource_registry;
+
+import glaze;
+import common;
+
+namespace backend::database {
+
+// In-process copy of the log_resources table. The resource set barely changes, so ingest and queries
+// can look up resources here instead of asking the database every time.
+export class ResourceRegistry {
+    public:
+        // glz::generic stores objects in a std::map, so serializing it yields sorted keys
+        static std::string canonicalize(const glz::generic& attributes) {
+            return glz::write_json(attributes).value_or("{}");
+        }
+
+        std::optional<unsigned int> find(const glz::generic& attributes) const {
+            std::string key = canonicalize(attributes);
+            std::shared_lock lock(mutex);
+            if(auto it = ids.find(key); it != ids.end()) {
+                return it->second;
+            }
+            return std::nullopt;
+        }
+        std::shared_ptr<const common::log_resource> get(unsigned int id) const {
+            std::shared_lock lock(mutex);
+            if(auto it = resources.find(id); it != resources.end()) {
+                return it->second;
+            }
+            return nullptr;
+        }
+        std::unordered_map<unsigned int, common::log_resource> snapshot() const {
+            std::shared_lock lock(mutex);
+            std::unordered_map<unsigned int, common::log_resource> result;
+            result.reserve(resources.size());
+            for(const auto& [id, resource] : resources) {
+                result.emplace(id, *resource);
+            }
+            return result;
+        }
+        std::size_t size() const {
+            std::shared_lock lock(mutex);
+            return resources.size();
+        }
+
+        void insert(common::log_resource resource) {
+            std::string key = canonicalize(resource.attributes);
+            auto ptr = std::make_shared<const common::log_resource>(std::move(resource));
+            std::unique_lock lock(mutex);
+            ids.insert_or_assign(std::move(key), ptr->id);
+            resources.insert_or_assign(ptr->id, std::move(ptr));
+        }
+    private:
+        mutable std::shared_mutex mutex;
+        std::unordered_map<std::string, unsigned int> ids;
+        std::unordered_map<unsigned int, std::shared_ptr<const common::log_resource>> resources;
+};
+
+}
@@ -1,9 +1,22 @@
 module;
+#include <algorithm>
 #include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
 #include <expected>
+#include <format>
 #include <future>
 #include <map>
+#include <mutex>
+#include <optional>
+#include <queue>
+#include <set>
+#include <stop_token>
+#include <string>
+#include <string_view>
 #include <utility>
+#include <vector>
 
 module backend.jobs;
 import spdlog;
@@ -12,6 +25,8 @@ import glaze;
 
 import common;
 
+import backend.database;
+
 namespace backend::jobs {
 
 std::string craft_cleanup_job_filter_sql(const common::cleanup_rule& rule, pqxx::connection& conn) {
@@ -70,27 +85,103 @@ std::string craft_cleanup_job_filter_sql(const common::cleanup_rule& rule, pqxx:
     return sql;
 }
 
-std::expected<int, std::string> execute_drop_cleanup_job(const common::cleanup_rule& rule, pqxx::connection& conn, spdlog::logger& logger) {
-    std::string sql = "DELETE FROM logs WHERE " + craft_cleanup_job_filter_sql(rule, conn);
-    if(sql.ends_with(" WHERE ")) {
-        logger.warn("Filter crafting failed for drop cleanup job {}:{}: {}", rule.id, rule.name, sql);
-        return std::unexpected("Failed to craft SQL for drop cleanup job");
+// Whether the rule only filters by age, so every log of a partition older than the minimum age matches it.
+bool is_age_only(const common::cleanup_rule& rule) {
+    return rule.filters.resources.values.empty() && rule.filters.scopes.values.empty() && rule.filters.severities.values.empty()
+        && rule.filters.attributes.values.empty() && rule.filters.attribute_values.values.empty();
+}
+
+// Drops the partitions lying entirely before the minimum age of an age-only rule. Partitions which fail to drop
+// are left to the DELETE batches of the remaining logs.
+std::size_t drop_covered_partitions(const common::cleanup_rule& rule, database::Database& db, pqxx::connection& conn, spdlog::logger& logger) {
+    auto cutoff = std::chrono::floor<std::chrono::seconds>(std::chrono::system_clock::now()) - rule.filter_minimum_age;
+    std::size_t dropped = 0;
+    for(const auto& range : db.partitions().ranges()) {
+        if(range.to > cutoff) {
+            continue;
+        }
+        try {
+            dropped += db.drop_partition(conn, range);
+        } catch(const std::exception& e) {
+            logger.warn("Failed to drop partition {} for drop cleanup job {}:{}, deleting its logs instead: {}", range.name, rule.id, rule.name, e.what());
+        }
     }
-    logger.debug("Executing drop cleanup job {}:{} with SQL: {}", rule.id, rule.name, sql);
+    return dropped;
+}
 
-    try {
-        pqxx::work txn(conn);
-        std::size_t affected_rows = txn.exec(sql).affected_rows();
-        txn.exec(pqxx::prepped{"complete_cleanup_rule"}, pqxx::params{rule.id});
-        txn.commit();
+// The last log processed by a cleanup run. Runs walk the matching logs in (timestamp, resource, scope) order.
+struct cleanup_watermark {
+    std::string timestamp; // as text, so it compares exactly against the column
+    unsigned int resource;
+    std::string scope;
+};
 
-        return affected_rows;
-    } catch(const std::exception& e) {
-        return std::unexpected(std::string("Error executing drop cleanup job: ") + e.what());
+struct cleanup_batch {
+    std::size_t matched = 0;  // logs matching the filter in this batch
+    std::size_t affected = 0; // logs deleted or changed
+    std::optional<cleanup_watermark> last;
+};
+
+std::optional<cleanup_watermark> load_watermark(const common::cleanup_rule& rule, pqxx::connection& conn) {
+    pqxx::nontransaction txn(conn);
+    auto result = txn.exec(pqxx::prepped{"get_cleanup_progress"}, pqxx::params{rule.id});
+    if(result.empty()) {
+        return std::nullopt;
     }
+    return cleanup_watermark{result[0]["timestamp"].as<std::string>(), result[0]["resource"].as<unsigned int>(), result[0]["scope"].as<std::string>()};
 }
 
-std::expected<int, std::string> execute_transform_cleanup_job(const common::cleanup_rule& rule, pqxx::connection& conn, spdlog::logger& logger) {
+// Selects the next batch of matching logs after the watermark.
+std::string craft_cleanup_batch_sql(const common::cleanup_rule& rule, const std::optional<cleanup_watermark>& watermark, std::size_t batch_size, std::string_view columns, pqxx::connection& conn) {
+    std::string sql = std::format("SELECT {} FROM logs WHERE {}", columns, craft_cleanup_job_filter_sql(rule, conn));
+    if(watermark) {
+        sql += " AND (timestamp, resource, scope) > ($1::timestamp, $2::integer, $3::text)";
+    }
+    sql += std::format(" ORDER BY timestamp, resource, scope LIMIT {}", batch_size);
+    return sql;
+}
+pqxx::params watermark_params(const std::optional<cleanup_watermark>& watermark) {
+    if(!watermark) {
+        return {};
+    }
+    return pqxx::params{watermark->timestamp, watermark->resource, watermark->scope};
+}
+
+void save_watermark(pqxx::transaction_base& txn, const common::cleanup_rule& rule, const cleanup_watermark& watermark) {
+    txn.exec(pqxx::prepped{"update_cleanup_progress"}, pqxx::params{rule.id, watermark.timestamp, watermark.resource, watermark.scope});
+}
+
+cleanup_batch execute_drop_cleanup_batch(const common::cleanup_rule& rule, const std::optional<cleanup_watermark>& watermark, std::size_t batch_size, pqxx::connection& conn) {
+    // the deleted logs are subtracted from log_counts and log_attributes in the same statement, so the counters never drift
+    // (their partitions are still marked as changed, like every write to logs)
+    std::string sql = std::format(
+        "WITH batch AS ({}), "
+        "deleted AS (DELETE FROM logs l USING batch b WHERE l.resource = b.resource AND l.timestamp = b.timestamp AND l.scope = b.scope "
+        "RETURNING l.tableoid, l.resource, l.scope, l.severity, l.timestamp, l.attributes), "
+        "counted AS (INSERT INTO log_counts (resource, scope, severity, day, count) "
+        "SELECT resource, scope, severity, timestamp::date, -COUNT(*) FROM deleted GROUP BY resource, scope, severity, timestamp::date "
+        "ORDER BY resource, scope, severity, timestamp::date "
+        "ON CONFLICT (resource, scope, severity, day) DO UPDATE SET count = log_counts.count + EXCLUDED.count), "
+        "{}, {} "
+        "SELECT (SELECT COUNT(*) FROM batch) AS matched, (SELECT COUNT(*) FROM deleted) AS affected, "
+        "last.timestamp::text AS timestamp, last.resource, last.scope "
+        "FROM (SELECT 1) AS dummy LEFT JOIN (SELECT * FROM batch ORDER BY timestamp DESC, resource DESC, scope DESC LIMIT 1) AS last ON TRUE",
+        craft_cleanup_batch_sql(rule, watermark, batch_size, "resource, timestamp, scope", conn), database::subtract_attributes_sql("deleted"),
+        database::mark_partitions_sql("deleted"));
+
+    pqxx::work txn(conn);
+    auto row = txn.exec(sql, watermark_params(watermark)).one_row();
+    cleanup_batch batch{row["matched"].as<std::size_t>(), row["affected"].as<std::size_t>()};
+    if(batch.matched > 0) {
+        batch.last = cleanup_watermark{row["timestamp"].as<std::string>(), row["resource"].as<unsigned int>(), row["scope"].as<std::string>()};
+        save_watermark(txn, rule, *batch.last);
+    }
+    txn.commit();
+    return batch;
+}
+
+// Parses the actions and compiles their stencils once for the whole job.
+std::expected<std::vector<common::compiled_transform_action>, std::string> parse_transform_actions(const common::cleanup_rule& rule) {
     if(!rule.action_options) {
         return std::unexpected("No action options provided for transform cleanup job");
     }
@@ -105,144 +196,311 @@ std::expected<int, std::string> execute_transform_cleanup_job(const common::clea
     if(!actions_expected) {
         return std::unexpected(std::string("Error parsing action options for transform cleanup job: ") + glz::format_error(actions_expected.error()));
     }
-    const auto& actions = *actions_expected;
-    if(actions.empty()) {
+    if(actions_expected->empty()) {
         return std::unexpected("No actions provided for transform cleanup job");
     }
+    return common::compile_transform_actions(*actions_expected).transform_error([](const std::string& error) {
+        return "Error compiling action options for transform cleanup job: " + error;
+    });
+}
+
+cleanup_batch execute_transform_cleanup_batch(const common::cleanup_rule& rule, const std::vector<common::compiled_transform_action>& actions,
+    const std::optional<cleanup_watermark>& watermark, std::size_t batch_size, database::Database& db, pqxx::connection& conn, spdlog::logger& logger)
+{
+    std::string sql = craft_cleanup_batch_sql(rule, watermark, batch_size,
+        "resource, timestamp::text AS timestamp_key, extract(epoch from timestamp) AS unix_time, scope, severity, attributes, body", conn);
+
+    pqxx::work txn(conn);
+    auto result = txn.exec(sql, watermark_params(watermark));
+    cleanup_batch batch{result.size()};
+    if(result.empty()) {
+        txn.commit();
+        return batch;
+    }
+
+    std::vector<unsigned int> resources;
+    std::vector<std::string> timestamps;
+    std::vector<std::string> scopes;
+    std::vector<std::string> attributes;
+    std::map<std::string, database::attribute_counts> deltas; // of the changed logs, applied in the same transaction
+    for(const auto& row : result) {
+        common::log_entry log{
+            row["resource"].as<unsigned int>(),
+            row["unix_time"].as<double>(),
+            row["scope"].as<std::string>(),
+            row["severity"].as<common::log_severity>(),
+            row["attributes"].as<glz::generic>(),
+            row["body"].as<glz::generic>()
+        };
+        auto old_keys = database::attribute_keys(log.attributes);
+        bool changed = common::apply_transform_actions(actions, log, [&](const common::compiled_transform_action&, std::string_view error) {
+            logger.warn("Error applying stencil for transform action in cleanup job {}:{}: {}", rule.id, rule.name, error);
+        });
+        if(!changed) {
+            continue;
+        }
+        for(const auto& [key, type] : old_keys) {
+            deltas[key].add(type, -1);
+        }
+        for(const auto& [key, type] : database::attribute_keys(log.attributes)) {
+            deltas[key].add(type);
+        }
+        resources.push_back(log.resource);
+        timestamps.push_back(row["timestamp_key"].as<std::string>());
+        scopes.push_back(std::move(log.scope));
+        attributes.push_back(glz::write_json(log.attributes).value_or("{}"));
+    }
 
-    std::string sql = "SELECT * FROM logs WHERE " + craft_cleanup_job_filter_sql(rule, conn);
-    if(sql.ends_with(" WHERE ")) {
-        logger.warn("Filter crafting failed for transform cleanup job {}:{}: {}", rule.id, rule.name, sql);
-        return std::unexpected("Failed to craft SQL for transform cleanup job");
+    if(!resources.empty()) {
+        // staged in a temporary table, so the whole batch is applied with a single set-based UPDATE
+        txn.exec("CREATE TEMPORARY TABLE cleanup_transform (resource INTEGER NOT NULL, timestamp TIMESTAMP WITHOUT TIME ZONE NOT NULL, "
+            "scope TEXT NOT NULL, attributes JSONB NOT NULL) ON COMMIT DROP");
+        txn.exec("INSERT INTO cleanup_transform (resource, timestamp, scope, attributes) "
+            "SELECT * FROM unnest($1::integer[], $2::timestamp[], $3::text[], $4::jsonb[])",
+            pqxx::params{txn, resources, timestamps, scopes, attributes});
+        batch.affected = txn.exec(std::format("WITH updated AS (UPDATE logs l SET attributes = t.attributes FROM cleanup_transform t "
+            "WHERE l.resource = t.resource AND l.timestamp = t.timestamp AND l.scope = t.scope RETURNING l.tableoid), {} "
+            "SELECT COUNT(*) FROM updated", database::mark_partitions_sql("updated"))).one_field().as<std::size_t>();
+        if(batch.affected < resources.size()) {
+            // the deltas cannot tell which logs vanished, so leave the statistics to the consistency check
+            logger.warn("Only {} of {} log(s) were updated in transform cleanup job {}:{}", batch.affected, resources.size(), rule.id, rule.name);
+            db.ensure_consistency();
+        } else {
+            db.apply_attribute_deltas(txn, deltas);
+        }
     }
-    logger.debug("Executing transform cleanup job {}:{} with SQL: {}", rule.id, rule.name, sql);
 
+    auto last = result[result.size() - 1];
+    batch.last = cleanup_watermark{last["timestamp_key"].as<std::string>(), last["resource"].as<unsigned int>(), last["scope"].as<std::string>()};
+    save_watermark(txn, rule, *batch.last);
+    txn.commit();
+    return batch;
+}
+
+// Sleeps until the given time, unless a stop is requested earlier. Returns false if it was.
+bool sleep_until(std::stop_token st, std::chrono::steady_clock::time_point time) {
+    std::mutex mutex;
+    std::condition_variable_any cv;
+    std::unique_lock lock(mutex);
+    return !cv.wait_until(lock, st, time, [] { return false; }) && !st.stop_requested();
+}
+
+std::chrono::steady_clock::time_point Jobs::reserve_cleanup_budget(std::size_t rows) {
+    auto now = std::chrono::steady_clock::now();
+    if(cleanup_rows_per_second == 0) {
+        return now;
+    }
+    std::unique_lock lock(budget_mutex);
+    auto start = std::max(budget_next, now);
+    budget_next = start + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+        std::chrono::duration<double>{static_cast<double>(rows) / cleanup_rows_per_second});
+    return start;
+}
+
+std::expected<std::size_t, std::string> Jobs::run_cleanup_job(const common::cleanup_rule& rule, std::stop_token st) {
+    std::vector<common::compiled_transform_action> actions;
+    if(rule.action == common::rule_action::TRANSFORM) {
+        auto parsed = parse_transform_actions(rule);
+        if(!parsed) {
+            return std::unexpected(parsed.error());
+        }
+        actions = std::move(*parsed);
+    }
+    // a batch should take about a second of the budget, so the pauses between batches stay short
+    std::size_t batch_size = cleanup_rows_per_second == 0 ? max_cleanup_batch_size : std::min(max_cleanup_batch_size, cleanup_rows_per_second);
+
+    std::size_t affected = 0;
     try {
-        pqxx::work txn(conn);
+        std::optional<cleanup_watermark> watermark;
+        db.queue_work(database::work_class::background, [&](pqxx::connection& conn) {
+            if(rule.action == common::rule_action::DROP && is_age_only(rule)) {
+                affected += drop_covered_partitions(rule, db, conn, *logger);
+            }
+            watermark = load_watermark(rule, conn);
+        }).get();
+        if(watermark) {
+            logger->info("Resuming cleanup job {}:{} after log at {}", rule.id, rule.name, watermark->timestamp);
+        }
 
-        int total_affected_rows = 0;
-        for(auto [resource, timestamp, scope, severity, attributes, body] :
-            txn.stream<unsigned int, double, std::string, common::log_severity, glz::generic, glz::generic>(sql))
-        {
-            common::log_entry log{resource, timestamp, scope, severity, attributes, body};
-            auto& attrs_obj = log.attributes.get_object();
-
-            for(const auto& action : actions) {
-                switch(action.type) {
-                    case common::transform_action_type::REMOVE_ATTRIBUTE:
-                        attrs_obj.erase(action.attribute);
-                        break;
-                    case common::transform_action_type::SET_ATTRIBUTE:
-                        if(!action.stencil) {
-                            logger.warn("No stencil provided for transform action in cleanup job {}:{}", rule.id, rule.name);
-                            continue;
-                        }
-                        if(auto value_expected = common::stencil(*action.stencil, log); value_expected) {
-                            attrs_obj[action.attribute] = std::move(*value_expected);
-                        } else {
-                            logger.warn("Error applying stencil for transform action in cleanup job {}:{}: {}", rule.id, rule.name, value_expected.error());
-                        }
-                        break;
-                    default:
-                        logger.error("Unsupported transform action type {} in cleanup job {}:{}", std::to_underlying(action.type), rule.id, rule.name);
-                        continue;
-                }
+        while(true) {
+            if(!sleep_until(st, reserve_cleanup_budget(batch_size))) {
+                logger->info("Interrupted cleanup job {}:{}, it will resume from its watermark", rule.id, rule.name);
+                return affected;
             }
-            int affected_rows = txn.exec(pqxx::prepped{"update_log_attributes"},
-                pqxx::params{txn,
-                    log.resource, log.timestamp, log.scope,
-                    log.attributes
-                }
-            ).affected_rows();
 
-            if(affected_rows > 0) {
-                total_affected_rows += affected_rows;
-            } else {
-                logger.warn("No rows affected when updating log in transform cleanup job {}:{}", rule.id, rule.name);
+            cleanup_batch batch;
+            db.queue_work(database::work_class::background, [&](pqxx::connection& conn) {
+                if(rule.action == common::rule_action::DROP) {
+                    batch = execute_drop_cleanup_batch(rule, watermark, batch_size, conn);
+                } else {
+                    batch = execute_transform_cleanup_batch(rule, actions, watermark, batch_size, db, conn, *logger);
+                }
+            }).get();
+            affected += batch.affected;
+            if(batch.matched < batch_size) {
+                break;
             }
+            watermark = std::move(batch.last);
         }
 
-        txn.exec(pqxx::prepped{"complete_cleanup_rule"}, pqxx::params{rule.id});
-        txn.commit();
-
-        return total_affected_rows;
+        db.queue_work(database::work_class::background, [&](pqxx::connection& conn) {
+            pqxx::work txn(conn);
+            txn.exec(pqxx::prepped{"complete_cleanup_rule"}, pqxx::params{rule.id});
+            txn.commit();
+        }).get();
     } catch(const std::exception& e) {
-        return std::unexpected(std::string("Error executing transform cleanup job: ") + e.what());
+        return std::unexpected(std::string("Error executing cleanup job: ") + e.what());
     }
+    return affected;
+}
 
-    return 0;
+// Rules which cannot run, e.g. because an INCLUDE filter without values would match nothing.
+std::optional<std::string_view> check_runnable(const common::cleanup_rule& rule) {
+    if(!rule.enabled) {
+        return "it is disabled";
+    }
+    if(rule.filters.resources.values.empty() && rule.filters.resources.type == common::filter_type::INCLUDE) {
+        return "it has a resource filter of type INCLUDE, but no resources are specified";
+    }
+    if(rule.filters.scopes.values.empty() && rule.filters.scopes.type == common::filter_type::INCLUDE) {
+        return "it has a scope filter of type INCLUDE, but no scopes are specified";
+    }
+    if(rule.filters.severities.values.empty() && rule.filters.severities.type == common::filter_type::INCLUDE) {
+        return "it has a severity filter of type INCLUDE, but no severities are specified";
+    }
+    if(rule.action != common::rule_action::DROP && rule.action != common::rule_action::TRANSFORM) {
+        return "its action is not supported";
+    }
+    return std::nullopt;
 }
 
-void Jobs::run_cleanup_jobs() {
-    logger->debug("Running cleanup jobs");
+void Jobs::set_cleanup_rules(std::map<unsigned int, common::cleanup_rule> rules) {
+    {
+        std::unique_lock lock(mutex);
+        pending_rules = std::move(rules);
+    }
+    scheduler_cv.notify_one();
+}
 
-    std::promise<void> promise;
-    std::future<void> future = promise.get_future();
+// Rebuilds the schedule from the current rules. Rules which are queued or running are scheduled again once they finish.
+void Jobs::reschedule_locked() {
+    schedule = {};
+    auto now = std::chrono::system_clock::now();
+    for(const auto& [id, rule] : cleanup_rules) {
+        if(auto reason = check_runnable(rule)) {
+            logger->debug("Not scheduling cleanup job {}:{} because {}", rule.id, rule.name, *reason);
+            continue;
+        }
+        if(active.contains(id)) {
+            continue;
+        }
+        auto due = rule.last_execution ? std::max<std::chrono::system_clock::time_point>(*rule.last_execution + rule.execution_interval, now) : now;
+        schedule.emplace(due, id);
+    }
+}
 
-    db.queue_work([this, promise = std::move(promise)](pqxx::connection& conn) mutable {
-        std::map<unsigned int, common::cleanup_rule> jobs;
-        {
-            pqxx::nontransaction txn(conn);
-            jobs = db.get_cleanup_rules(txn);
+// Hands all due rules to the runners and returns when the next one is due.
+std::optional<std::chrono::system_clock::time_point> Jobs::dispatch_locked() {
+    auto now = std::chrono::system_clock::now();
+    while(!schedule.empty() && schedule.top().first <= now) {
+        auto id = schedule.top().second;
+        schedule.pop();
+        auto it = cleanup_rules.find(id);
+        if(it == cleanup_rules.end() || active.contains(id)) {
+            continue;
         }
-        logger->debug("Fetched {} cleanup jobs", jobs.size());
+        active.insert(id);
+        ready.push_back(it->second);
+        runner_cv.notify_one();
+    }
+    if(schedule.empty()) {
+        return std::nullopt;
+    }
+    return schedule.top().first;
+}
 
-        bool any_jobs_ran = false;
-        for(const auto& [_, rule] : jobs) {
-            if(!rule.enabled) {
-                logger->trace("Skipping cleanup job {}:{} because it is disabled", rule.id, rule.name);
-                continue;
+void Jobs::scheduler_thread(std::stop_token st) {
+    auto next_partition_run = std::chrono::system_clock::now();
+    bool loaded = false;
+    while(!st.stop_requested()) {
+        if(std::chrono::system_clock::now() >= next_partition_run) {
+            try {
+                run_partition_jobs();
+            } catch(const std::exception& e) {
+                logger->error("Error in partition maintenance: {}", e.what());
             }
-            if(rule.last_execution && *rule.last_execution > std::chrono::system_clock::now() - rule.execution_interval) {
-                logger->trace("Skipping cleanup job {}:{} because it was executed recently", rule.id, rule.name);
-                continue;
+            next_partition_run = std::chrono::system_clock::now() + partition_interval;
+        }
+        if(!loaded) { // until it works once, later changes arrive by notification
+            try {
+                std::map<unsigned int, common::cleanup_rule> rules;
+                db.queue_work(database::work_class::background, [this, &rules](pqxx::connection& conn) {
+                    pqxx::nontransaction txn(conn);
+                    rules = db.get_cleanup_rules(txn);
+                }).get();
+                set_cleanup_rules(std::move(rules));
+                loaded = true;
+            } catch(const std::exception& e) {
+                logger->error("Failed to load cleanup rules, will retry: {}", e.what());
             }
+        }
 
-            if(rule.filters.resources.values.empty() && rule.filters.resources.type == common::filter_type::INCLUDE) {
-                logger->warn("Skipping cleanup job {}:{} because it has a resource filter of type INCLUDE, but no resources are specified", rule.id, rule.name);
-                continue;
-            }
-            if(rule.filters.scopes.values.empty() && rule.filters.scopes.type == common::filter_type::INCLUDE) {
-                logger->warn("Skipping cleanup job {}:{} because it has a scope filter of type INCLUDE, but no scopes are specified", rule.id, rule.name);
-                continue;
-            }
-            if(rule.filters.severities.values.empty() && rule.filters.severities.type == common::filter_type::INCLUDE) {
-                logger->warn("Skipping cleanup job {}:{} because it has a severity filter of type INCLUDE, but no severities are specified", rule.id, rule.name);
+        std::unique_lock lock(mutex);
+        if(pending_rules) {
+            cleanup_rules = std::move(*pending_rules);
+            pending_rules.reset();
+            logger->debug("Scheduling {} cleanup rule(s)", cleanup_rules.size());
+            reschedule_locked();
+        }
+        auto now = std::chrono::system_clock::now();
+        for(const auto& [id, success] : finished) {
+            active.erase(id);
+            auto it = cleanup_rules.find(id);
+            if(it == cleanup_rules.end() || check_runnable(it->second)) {
                 continue;
             }
+            // failed runs are retried soon, like they were when rules were polled
+            schedule.emplace(now + (success ? it->second.execution_interval : failure_retry_delay), id);
+        }
+        finished.clear();
 
-            std::expected<int, std::string> result{};
-            switch(rule.action) {
-                case common::rule_action::DROP:
-                    result = execute_drop_cleanup_job(rule, conn, *logger);
-                    break;
-                case common::rule_action::TRANSFORM:
-                    result = execute_transform_cleanup_job(rule, conn, *logger);
-                    break;
-                default:
-                    logger->error("Unsupported cleanup action {} for job {}:{}", std::to_underlying(rule.action), rule.id, rule.name);
-                    continue;
-            }
-            if(result) {
-                logger->info("Executed cleanup job {}:{} successfully, affected rows: {}", rule.id, rule.name, *result);
-                if(*result > 0) {
-                    any_jobs_ran = true;
-                }
-            } else {
-                logger->error("Error executing cleanup job {}:{}: {}", rule.id, rule.name, result.error());
+        auto wake = next_partition_run;
+        if(auto next = dispatch_locked(); next && *next < wake) {
+            wake = *next;
+        }
+        if(!loaded) {
+            wake = std::min(wake, now + failure_retry_delay);
+        }
+        scheduler_cv.wait_until(lock, st, wake, [this] { return pending_rules.has_value() || !finished.empty(); });
+    }
+}
+
+void Jobs::runner_thread(std::stop_token st) {
+    while(true) {
+        common::cleanup_rule rule;
+        {
+            std::unique_lock lock(mutex);
+            if(!runner_cv.wait(lock, st, [this] { return !ready.empty(); })) {
+                return;
             }
+            rule = std::move(ready.front());
+            ready.pop_front();
         }
-        logger->debug("Finished executing cleanup jobs");
 
-        if(any_jobs_ran) {
-            logger->debug("Rebuilding attribute statistics");
-            db.ensure_consistency(conn);
+        logger->debug("Running cleanup job {}:{}", rule.id, rule.name);
+        auto result = run_cleanup_job(rule, st);
+        if(result) {
+            logger->info("Executed cleanup job {}:{} successfully, affected rows: {}", rule.id, rule.name, *result);
+        } else {
+            logger->error("Error executing cleanup job {}:{}: {}", rule.id, rule.name, result.error());
         }
 
-        promise.set_value();
-    });
-    future.wait();
-    logger->debug("Finished cleanup jobs");
+        {
+            std::unique_lock lock(mutex);
+            finished.emplace_back(rule.id, result.has_value());
+        }
+        scheduler_cv.notify_one();
+    }
 }
 
 }
@@ -1,18 +1,35 @@
 module;
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <expected>
 #include <functional>
+#include <map>
 #include <memory>
+#include <mutex>
+#include <optional>
+#include <queue>
+#include <set>
+#include <string>
 #include <thread>
+#include <utility>
+#include <vector>
 
 export module backend.jobs;
 
+import pqxx;
 import spdlog;
 
+import common;
 import backend.database;
 
 namespace backend::jobs {
 
 export class Jobs {
     public:
+        constexpr static std::size_t default_cleanup_rows_per_second = 10000;
+
         Jobs(database::Database& db)
             : db(db), logger(spdlog::default_logger()->clone("jobs"))
         {
@@ -21,30 +38,70 @@ export class Jobs {
 
         void start() {
             logger->info("Starting jobs thread");
-            thread = std::jthread(std::bind(&Jobs::job_thread, this, std::placeholders::_1));
+            // listen before the scheduler loads the rules, so changes in between are not missed
+            db.listen("cleanup_rules", [this](pqxx::notification notification) {
+                pqxx::nontransaction txn(notification.conn);
+                set_cleanup_rules(db.get_cleanup_rules(txn));
+                logger->info("Reloaded cleanup rules");
+            });
+            thread = std::jthread(std::bind(&Jobs::scheduler_thread, this, std::placeholders::_1));
+            pthread_setname_np(thread.native_handle(), "jobs");
+            for(std::size_t i = 0; i < max_parallel_cleanup_jobs; i++) {
+                auto& runner = runners.emplace_back(std::bind(&Jobs::runner_thread, this, std::placeholders::_1));
+                pthread_setname_np(runner.native_handle(), "jobs-cleanup");
+            }
         }
-    private:
-        static constexpr auto job_interval = std::chrono::minutes(1);
 
-        void job_thread(std::stop_token st) {
-            std::this_thread::sleep_for(std::chrono::seconds(10));
+        // Maximum number of logs cleanup jobs go through per second, so they do not starve ingest. 0 means unlimited.
+        // The budget is shared by all cleanup jobs running at the same time.
+        void set_cleanup_rate(std::size_t rows_per_second) {
+            cleanup_rows_per_second = rows_per_second;
+        }
+    private:
+        static constexpr auto partition_interval = std::chrono::minutes(1);
+        static constexpr auto partition_lookahead = std::chrono::days(3);
+        static constexpr auto failure_retry_delay = std::chrono::minutes(1);
+        static constexpr std::size_t max_cleanup_batch_size = 1000;
+        static constexpr std::size_t max_parallel_cleanup_jobs = 4;
 
-            while(!st.stop_requested()) {
-                try {
-                    run_cleanup_jobs();
+        // Runs partition maintenance and hands cleanup rules to the runners exactly when they are due.
+        void scheduler_thread(std::stop_token st);
+        // Runs cleanup jobs handed over by the scheduler, so a slow rule does not delay the others.
+        void runner_thread(std::stop_token st);
 
-                    std::this_thread::sleep_for(job_interval);
-                } catch(const std::exception& e) {
-                    logger->error("Error in jobs thread: {}", e.what());
-                }
-            }
-        }
+        void set_cleanup_rules(std::map<unsigned int, common::cleanup_rule> rules);
+        void reschedule_locked();
+        std::optional<std::chrono::system_clock::time_point> dispatch_locked();
 
-        void run_cleanup_jobs();
+        // Runs a cleanup job in batches with a commit each. Returns early (but successfully) when a stop is requested,
+        // the next run resumes from the persisted watermark.
+        std::expected<std::size_t, std::string> run_cleanup_job(const common::cleanup_rule& rule, std::stop_token st);
+        // Reserves budget for a batch of the given size and returns when the batch may start.
+        std::chrono::steady_clock::time_point reserve_cleanup_budget(std::size_t rows);
+        void run_partition_jobs();
 
-        std::jthread thread;
         std::shared_ptr<spdlog::logger> logger;
         database::Database& db;
+        std::size_t cleanup_rows_per_second = default_cleanup_rows_per_second;
+
+        std::mutex budget_mutex;
+        std::chrono::steady_clock::time_point budget_next{};
+
+        std::mutex mutex;
+        std::condition_variable_any scheduler_cv;
+        std::condition_variable_any runner_cv;
+        std::optional<std::map<unsigned int, common::cleanup_rule>> pending_rules; // loaded, but not scheduled yet
+        std::map<unsigned int, common::cleanup_rule> cleanup_rules;
+        // min-heap of when each rule is due next
+        std::priority_queue<std::pair<std::chrono::system_clock::time_point, unsigned int>,
+            std::vector<std::pair<std::chrono::system_clock::time_point, unsigned int>>, std::greater<>> schedule;
+        std::set<unsigned int> active; // queued or running
+        std::deque<common::cleanup_rule> ready;
+        std::vector<std::pair<unsigned int, bool>> finished; // rule and whether it succeeded
+
+        // declared last, so they are stopped before anything they use is destroyed
+        std::jthread thread;
+        std::vector<std::jthread> runners;
 };
 
 }
@@ -0,0 +1,31 @@
+module;
+#include <chrono>
+#include <future>
+
+module backend.jobs;
+import spdlog;
+import pqxx;
+
+import backend.database;
+
+namespace backend::jobs {
+
+void Jobs::run_partition_jobs() {
+    logger->debug("Running partition maintenance");
+
+    db.queue_work(database::work_class::background, [this](pqxx::connection& conn) {
+        {
+            pqxx::nontransaction txn(conn);
+            db.load_partitions(txn);
+        }
+
+        // the smallest granularity is one hour, so checking every hour is enough to cover every partition
+        auto now = std::chrono::floor<std::chrono::hours>(std::chrono::system_clock::now());
+        for(auto ts = now; ts <= now + partition_lookahead; ts += std::chrono::hours{1}) {
+            db.ensure_partition(conn, ts);
+        }
+    }).get();
+    logger->debug("Finished partition maintenance");
+}
+
+}
@@ -1,4 +1,5 @@
 #include <algorithm>
+#include <charconv>
 #include <concepts>
 #include <iostream>
 #include <map>
@@ -13,6 +14,7 @@ import spdlog;
 import common;
 import backend.database;
 import backend.jobs;
+import backend.alerts;
 import backend.opentelemetry;
 import backend.web;
 import backend.notifications;
@@ -66,6 +68,20 @@ std::optional<T> env_present(argparse::ArgumentParser& parser, std::string_view
     return parser.present<T>(arg);
 }
 
+// Parses a numeric option, printing an error with the usage if it is invalid.
+template<std::unsigned_integral T = std::size_t>
+std::optional<T> parse_unsigned_option(argparse::ArgumentParser& parser, std::string_view arg, std::string_view description, bool allow_zero) {
+    std::string value = env_get(parser, arg);
+    T result{};
+    auto [end, ec] = std::from_chars(value.data(), value.data() + value.size(), result);
+    if(ec != std::errc{} || end != value.data() + value.size() || (!allow_zero && result == 0)) {
+        std::cerr << "Invalid " << description << ": " << value << std::endl;
+        std::cerr << parser;
+        return std::nullopt;
+    }
+    return result;
+}
+
 constexpr const char* default_ip_filter =
     // block local, private, and zero-conf IPv4
     "10.0.0.0/8,172.16.0.0/12,192.168.0.0/16,127.0.0.0/8,169.254.0.0/16,0.0.0.0/8,"
@@ -83,6 +99,15 @@ int main(int argc, char** argv) {
     program.add_argument("--otel-address").default_value("0.0.0.0:4318")
         .help("Address to listen for OpenTelemetry requests on (env: CUTIE_LOGS_OTEL_ADDRESS)")
         .nargs(1).metavar("ADDRESS");
+    program.add_argument("--otel-max-decompressed-size").default_value("256")
+        .help("Maximum size in MiB of a compressed OpenTelemetry request after decompression (env: CUTIE_LOGS_OTEL_MAX_DECOMPRESSED_SIZE)")
+        .nargs(1).metavar("MIB");
+    program.add_argument("--spool-dir")
+        .help("Directory to spool OpenTelemetry requests in, so they are acknowledged before being inserted into the database (env: CUTIE_LOGS_SPOOL_DIR)")
+        .nargs(1).metavar("PATH");
+    program.add_argument("--spool-max-size").default_value("1024")
+        .help("Maximum size in MiB of spooled requests waiting to be inserted, 0 for unlimited (env: CUTIE_LOGS_SPOOL_MAX_SIZE)")
+        .nargs(1).metavar("MIB");
     program.add_argument("--web-address").default_value("127.0.0.1:8080")
         .help("Address to serve web interface on (env: CUTIE_LOGS_WEB_ADDRESS)")
         .nargs(1).metavar("ADDRESS");
@@ -107,6 +132,21 @@ int main(int argc, char** argv) {
     program.add_argument("--self-ingest").default_value(false)
         .help("Ingest internal instance logs back into the local database (env: CUTIE_LOGS_SELF_INGEST)")
         .implicit_value(true);
+    program.add_argument("--partition-granularity").default_value("daily")
+        .help("Time span covered by each partition of the logs table: hourly, daily or weekly (env: CUTIE_LOGS_PARTITION_GRANULARITY)")
+        .nargs(1).metavar("GRANULARITY");
+    program.add_argument("--database-queue-size").default_value("256")
+        .help("Maximum number of queued database jobs before OpenTelemetry requests are rejected, 0 for unlimited (env: CUTIE_LOGS_DATABASE_QUEUE_SIZE)")
+        .nargs(1).metavar("COUNT");
+    program.add_argument("--database-min-connections").default_value(std::to_string(backend::database::pool_options::default_min_connections))
+        .help("Number of database connections kept open at all times (env: CUTIE_LOGS_DATABASE_MIN_CONNECTIONS)")
+        .nargs(1).metavar("COUNT");
+    program.add_argument("--database-max-connections").default_value(std::to_string(backend::database::pool_options::default_max_connections))
+        .help("Number of database connections opened at most while work is waiting (env: CUTIE_LOGS_DATABASE_MAX_CONNECTIONS)")
+        .nargs(1).metavar("COUNT");
+    program.add_argument("--cleanup-rows-per-second").default_value(std::to_string(backend::jobs::Jobs::default_cleanup_rows_per_second))
+        .help("Maximum number of logs cleanup jobs go through per second, 0 for unlimited (env: CUTIE_LOGS_CLEANUP_ROWS_PER_SECOND)")
+        .nargs(1).metavar("COUNT");
     program.add_argument("--outgoing-ip-filter")
         .help("Filter for outgoing IP addresses for notifications (env: CUTIE_LOGS_OUTGOING_IP_FILTER)")
         .nargs(1).metavar("FILTER");
@@ -126,7 +166,50 @@ int main(int argc, char** argv) {
     using namespace backend;
     spdlog::info("Starting {} version {}", common::project_name, common::project_version);
 
-    database::Database db(env_get<std::string>(program, "--database-url"));
+    auto granularity = database::parse_partition_granularity(env_get(program, "--partition-granularity"));
+    if(!granularity) {
+        std::cerr << "Invalid partition granularity: " << env_get(program, "--partition-granularity") << std::endl;
+        std::cerr << program;
+        return 2;
+    }
+
+    auto max_decompressed_mib = parse_unsigned_option(program, "--otel-max-decompressed-size", "maximum decompressed size", false);
+    if(!max_decompressed_mib) {
+        return 2;
+    }
+    auto spool_max_mib = parse_unsigned_option(program, "--spool-max-size", "maximum spool size", true);
+    if(!spool_max_mib) {
+        return 2;
+    }
+    auto queue_size = parse_unsigned_option(program, "--database-queue-size", "database queue size", true);
+    if(!queue_size) {
+        return 2;
+    }
+    auto min_connections = parse_unsigned_option<unsigned int>(program, "--database-min-connections", "minimum database connections", false);
+    if(!min_connections) {
+        return 2;
+    }
+    auto max_connections = parse_unsigned_option<unsigned int>(program, "--database-max-connections", "maximum database connections", false);
+    if(!max_connections) {
+        return 2;
+    }
+    auto cleanup_rate = parse_unsigned_option(program, "--cleanup-rows-per-second", "cleanup rate", true);
+    if(!cleanup_rate) {
+        return 2;
+    }
+
+    database::pool_options pool_options{};
+    pool_options.min_connections = *min_connections;
+    pool_options.max_connections = *max_connections;
+    if(pool_options.max_connections < pool_options.min_connections) {
+        std::cerr << "Maximum database connections must not be less than the minimum" << std::endl;
+        std::cerr << program;
+        return 2;
+    }
+
+    database::Database db(env_get<std::string>(program, "--database-url"), pool_options);
+    db.set_max_queue_size(*queue_size);
+    db.set_partition_granularity(*granularity);
     db.run_migrations();
     if(!env_get<bool>(program, "--skip-database-consistency")) {
         db.ensure_consistency();
@@ -177,6 +260,7 @@ int main(int argc, char** argv) {
     }
 
     jobs::Jobs job_runner(db);
+    job_runner.set_cleanup_rate(*cleanup_rate);
     job_runner.start();
 
     web::Server web_server(db, settings, Pistache::Address(env_get(program, "--web-address")));
@@ -188,7 +272,14 @@ int main(int argc, char** argv) {
         web_server.serve_threaded();
     }
 
-    opentelemetry::Server opentelemetry_server(db, &ip_filter, Pistache::Address(env_get(program, "--otel-address")));
+    alerts::Dispatcher alert_dispatcher(db, &ip_filter);
+    alert_dispatcher.start();
+
+    opentelemetry::Server opentelemetry_server(db, alert_dispatcher, Pistache::Address(env_get(program, "--otel-address")));
+    opentelemetry_server.set_max_decompressed_size(*max_decompressed_mib * 1024 * 1024);
+    if(auto spool_dir = env_present(program, "--spool-dir")) {
+        opentelemetry_server.enable_spool(*spool_dir, *spool_max_mib * 1024 * 1024);
+    }
     opentelemetry_server.serve();
 
     return 0;
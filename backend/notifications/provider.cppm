@@ -36,6 +36,7 @@ export class provider {
         provider() = default;
         virtual ~provider() = default;
 
+        // Providers are created once per alert rule and reused, so this may be called from several threads at once.
         virtual std::expected<void, error> notify(spdlog::logger& logger, const common::alert_stencil_object& msg, NetworkIpFilter* ipFilter) = 0;
 };
 
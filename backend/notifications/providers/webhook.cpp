@@ -1,7 +1,9 @@
 module;
 #include <expected>
 #include <memory>
+#include <mutex>
 #include <string>
+#include <vector>
 
 #include <netinet/in.h>
 #include <curl/curl.h>
@@ -74,16 +76,22 @@ class webhook_provider : public provider {
 
             curl_opensocket_data_t curl_opensocket_data{ipFilter, logger};
 
-            cpr::Session session{};
-            session.SetUrl(cpr::Url{m_url});
-            session.SetBody(cpr::Body{std::move(*json_payload)});
-            session.SetHeader(cpr::Header{{"Content-Type", "application/json"}});
+            auto session = acquire_session();
+            session->SetBody(cpr::Body{std::move(*json_payload)});
             if(ipFilter) {
-                curl_easy_setopt(session.GetCurlHolder()->handle, CURLOPT_OPENSOCKETFUNCTION, curl_opensocket_function);
-                curl_easy_setopt(session.GetCurlHolder()->handle, CURLOPT_OPENSOCKETDATA, &curl_opensocket_data);
+                curl_easy_setopt(session->GetCurlHolder()->handle, CURLOPT_OPENSOCKETFUNCTION, curl_opensocket_function);
+                curl_easy_setopt(session->GetCurlHolder()->handle, CURLOPT_OPENSOCKETDATA, &curl_opensocket_data);
+            } else {
+                curl_easy_setopt(session->GetCurlHolder()->handle, CURLOPT_OPENSOCKETFUNCTION, nullptr);
+                curl_easy_setopt(session->GetCurlHolder()->handle, CURLOPT_OPENSOCKETDATA, nullptr);
             }
 
-            auto res = session.Post();
+            auto res = session->Post();
+            // the socket data lives on our stack, so it must not be used by whoever gets the session next
+            curl_easy_setopt(session->GetCurlHolder()->handle, CURLOPT_OPENSOCKETDATA, nullptr);
+            if(res.status_code != 0) {
+                release_session(std::move(session));
+            }
             if(res.status_code == 0) {
                 return std::unexpected<error>(std::in_place, error_code::internal_error,
                     "Failed to send notification: " + res.error.message);
@@ -96,8 +104,35 @@ class webhook_provider : public provider {
             return std::expected<void, error>{};
         }
     private:
+        constexpr static std::size_t max_idle_sessions = 4;
+
+        // Sessions keep their connection alive, so repeated notifications skip the TCP and TLS handshakes.
+        std::unique_ptr<cpr::Session> acquire_session() {
+            {
+                std::unique_lock lock(m_sessions_mutex);
+                if(!m_sessions.empty()) {
+                    auto session = std::move(m_sessions.back());
+                    m_sessions.pop_back();
+                    return session;
+                }
+            }
+            auto session = std::make_unique<cpr::Session>();
+            session->SetUrl(cpr::Url{m_url});
+            session->SetHeader(cpr::Header{{"Content-Type", "application/json"}});
+            return session;
+        }
+        void release_session(std::unique_ptr<cpr::Session> session) {
+            std::unique_lock lock(m_sessions_mutex);
+            if(m_sessions.size() < max_idle_sessions) {
+                m_sessions.push_back(std::move(session));
+            }
+        }
+
         std::string m_url;
         glz::generic m_template;
+
+        std::mutex m_sessions_mutex;
+        std::vector<std::unique_ptr<cpr::Session>> m_sessions;
 };
 auto webhook_factory(const glz::generic& default_template) -> registry::func {
     return [default_template](spdlog::logger& logger, const glz::generic& options) -> std::expected<std::unique_ptr<provider>, error> {
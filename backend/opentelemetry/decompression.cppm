@@ -0,0 +1,184 @@
+module;
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+
+#include <zlib.h>
+#include <zstd.h>
+
+export module backend.opentelemetry:decompression;
+
+import proto;
+
+namespace backend::opentelemetry {
+
+enum class compression {
+    gzip, deflate, zstd
+};
+
+// Decompresses a request body chunk by chunk while protobuf is parsing it, so the decompressed body
+// never has to exist in memory as a whole. Decompression stops once more than max_size bytes were produced.
+class DecompressingStream : public google::protobuf::io::ZeroCopyInputStream {
+    public:
+        constexpr static std::size_t chunk_size = 64 * 1024;
+
+        DecompressingStream(compression algorithm, std::string_view input, std::size_t max_size)
+            : algorithm(algorithm), input(input), max_size(max_size), buffer(std::make_unique<char[]>(chunk_size))
+        {
+            if(algorithm == compression::zstd) {
+                zstd = ZSTD_createDStream();
+                if(!zstd) {
+                    error = "Failed to initialize zstd";
+                }
+            } else {
+                zlib.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(input.data()));
+                zlib.avail_in = static_cast<uInt>(input.size());
+                // 16 selects the gzip wrapper, "deflate" in HTTP means the zlib wrapper
+                if(inflateInit2(&zlib, algorithm == compression::gzip ? MAX_WBITS + 16 : MAX_WBITS) != Z_OK) {
+                    error = "Failed to initialize zlib";
+                } else {
+                    zlib_initialized = true;
+                }
+            }
+        }
+        ~DecompressingStream() override {
+            if(zstd) {
+                ZSTD_freeDStream(zstd);
+            }
+            if(zlib_initialized) {
+                inflateEnd(&zlib);
+            }
+        }
+        DecompressingStream(const DecompressingStream&) = delete;
+        DecompressingStream& operator=(const DecompressingStream&) = delete;
+
+        bool Next(const void** data, int* size) override {
+            if(position == available && !fill()) {
+                return false;
+            }
+            *data = buffer.get() + position;
+            *size = static_cast<int>(available - position);
+            byte_count += available - position;
+            position = available;
+            return true;
+        }
+        void BackUp(int count) override {
+            position -= count;
+            byte_count -= count;
+        }
+        bool Skip(int count) override {
+            while(true) {
+                std::size_t remaining = available - position;
+                if(static_cast<std::size_t>(count) <= remaining) {
+                    position += count;
+                    byte_count += count;
+                    return true;
+                }
+                count -= static_cast<int>(remaining);
+                byte_count += remaining;
+                position = available;
+                if(!fill()) {
+                    return false;
+                }
+            }
+        }
+        int64_t ByteCount() const override {
+            return byte_count;
+        }
+
+        bool limit_exceeded() const {
+            return exceeded;
+        }
+        const std::optional<std::string>& error_message() const {
+            return error;
+        }
+    private:
+        // Decompresses the next chunk into the buffer. Returns false at the end of the data or on errors.
+        bool fill() {
+            if(finished || exceeded || error) {
+                return false;
+            }
+            std::size_t produced = algorithm == compression::zstd ? fill_zstd() : fill_zlib();
+            if(produced == 0) {
+                return false;
+            }
+            total_size += produced;
+            if(total_size > max_size) {
+                exceeded = true;
+                return false;
+            }
+            position = 0;
+            available = produced;
+            return true;
+        }
+        std::size_t fill_zlib() {
+            zlib.next_out = reinterpret_cast<Bytef*>(buffer.get());
+            zlib.avail_out = static_cast<uInt>(chunk_size);
+            while(zlib.avail_out > 0) {
+                if(stream_end) {
+                    if(zlib.avail_in == 0) {
+                        finished = true;
+                        break;
+                    }
+                    // concatenated gzip members form a single body
+                    inflateReset(&zlib);
+                    stream_end = false;
+                }
+                int ret = inflate(&zlib, Z_NO_FLUSH);
+                if(ret == Z_STREAM_END) {
+                    stream_end = true;
+                } else if(ret == Z_BUF_ERROR && zlib.avail_in == 0) {
+                    error = "Compressed data is truncated";
+                    break;
+                } else if(ret != Z_OK) {
+                    error = zlib.msg ? zlib.msg : "Invalid compressed data";
+                    break;
+                }
+            }
+            return chunk_size - zlib.avail_out;
+        }
+        std::size_t fill_zstd() {
+            ZSTD_outBuffer out{buffer.get(), chunk_size, 0};
+            while(out.pos == 0) {
+                ZSTD_inBuffer in{input.data(), input.size(), input_position};
+                std::size_t ret = ZSTD_decompressStream(zstd, &out, &in);
+                input_position = in.pos;
+                if(ZSTD_isError(ret)) {
+                    error = ZSTD_getErrorName(ret);
+                    break;
+                }
+                if(out.pos == 0 && input_position == input.size()) {
+                    if(ret != 0) {
+                        error = "Compressed data is truncated";
+                    }
+                    finished = true;
+                    break;
+                }
+            }
+            return out.pos;
+        }
+
+        compression algorithm;
+        std::string_view input;
+        std::size_t max_size;
+
+        std::unique_ptr<char[]> buffer;
+        std::size_t position = 0;  // start of the data not yet handed out
+        std::size_t available = 0; // amount of valid data in the buffer
+        int64_t byte_count = 0;
+        std::size_t total_size = 0;
+
+        z_stream zlib{};
+        bool zlib_initialized = false;
+        bool stream_end = false;
+        ZSTD_DStream* zstd = nullptr;
+        std::size_t input_position = 0;
+
+        bool finished = false;
+        bool exceeded = false;
+        std::optional<std::string> error;
+};
+
+}
@@ -0,0 +1,198 @@
+module;
+#include <charconv>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <vector>
+
+export module backend.opentelemetry:json_writer;
+
+import proto;
+import backend.database;
+
+namespace backend::opentelemetry {
+
+using ::opentelemetry::proto::common::v1::AnyValue;
+using ::opentelemetry::proto::common::v1::KeyValue;
+using KeyValues = ::google::protobuf::RepeatedPtrField<KeyValue>;
+
+// Writes OTLP values directly as JSON text, without building a glz::generic tree first.
+// The output is equivalent to what glaze produced for the tree: non-printable characters are removed from
+// string values and duplicate keys are kept, which is fine because jsonb keeps the last one anyway.
+class JsonWriter {
+    public:
+        // Serializes the attribute list as a JSON object and collects the top-level keys for the attribute statistics.
+        static void write_attributes(std::string& out, const KeyValues& values, std::vector<database::attribute_key>& keys) {
+            keys.clear();
+            keys.reserve(values.size());
+            out.push_back('{');
+            bool first = true;
+            for(const auto& kv : values) {
+                if(!first) out.push_back(',');
+                first = false;
+                write_key(out, kv.key());
+                out.push_back(':');
+                write_value(out, kv.value());
+                add_key(keys, kv.key(), type_of(kv.value()));
+            }
+            out.push_back('}');
+        }
+        static void write_value(std::string& out, const AnyValue& v) {
+            if(v.has_bool_value()) {
+                out.append(v.bool_value() ? "true" : "false");
+            } else if(v.has_int_value()) {
+                write_number(out, v.int_value());
+            } else if(v.has_double_value()) {
+                double d = v.double_value();
+                if(std::isfinite(d)) {
+                    write_number(out, d);
+                } else {
+                    out.append("null"); // JSON (and jsonb) has no representation for NaN and infinity
+                }
+            } else if(v.has_string_value()) {
+                write_printable(out, v.string_value());
+            } else if(v.has_kvlist_value()) {
+                out.push_back('{');
+                bool first = true;
+                for(const auto& kv : v.kvlist_value().values()) {
+                    if(!first) out.push_back(',');
+                    first = false;
+                    write_key(out, kv.key());
+                    out.push_back(':');
+                    write_value(out, kv.value());
+                }
+                out.push_back('}');
+            } else if(v.has_array_value()) {
+                out.push_back('[');
+                bool first = true;
+                for(const auto& elem : v.array_value().values()) {
+                    if(!first) out.push_back(',');
+                    first = false;
+                    write_value(out, elem);
+                }
+                out.push_back(']');
+            } else if(v.has_bytes_value()) {
+                out.push_back('[');
+                bool first = true;
+                for(char c : v.bytes_value()) {
+                    if(!first) out.push_back(',');
+                    first = false;
+                    write_number(out, static_cast<unsigned int>(static_cast<unsigned char>(c)));
+                }
+                out.push_back(']');
+            } else {
+                out.append("null");
+            }
+        }
+
+        static database::json_type type_of(const AnyValue& v) {
+            if(v.has_bool_value()) return database::json_type::boolean;
+            if(v.has_int_value()) return database::json_type::number;
+            if(v.has_double_value()) return std::isfinite(v.double_value()) ? database::json_type::number : database::json_type::null;
+            if(v.has_string_value()) return database::json_type::string;
+            if(v.has_kvlist_value()) return database::json_type::object;
+            if(v.has_array_value() || v.has_bytes_value()) return database::json_type::array;
+            return database::json_type::null;
+        }
+    private:
+        template<typename T>
+        static void write_number(std::string& out, T value) {
+            char buf[32];
+            auto [end, ec] = std::to_chars(buf, buf + sizeof(buf), value);
+            out.append(buf, end);
+        }
+
+        // Writes a string value, dropping everything outside of printable ASCII (like std::isprint in the "C" locale did).
+        // Blocks of 8 bytes that need no treatment at all are detected with a few integer operations and skipped in one go.
+        static void write_printable(std::string& out, std::string_view s) {
+            out.reserve(out.size() + s.size() + 2);
+            out.push_back('"');
+
+            const char* p = s.data();
+            const char* end = p + s.size();
+            const char* run = p; // start of the bytes which can be copied verbatim
+            auto handle = [&](const char* c) {
+                unsigned char ch = static_cast<unsigned char>(*c);
+                bool printable = ch >= 0x20 && ch < 0x7f;
+                if(printable && ch != '"' && ch != '\\') {
+                    return;
+                }
+                out.append(run, c);
+                if(printable) {
+                    out.push_back('\\');
+                    out.push_back(static_cast<char>(ch));
+                }
+                run = c + 1;
+            };
+
+            for(; end - p >= 8; p += 8) {
+                std::uint64_t block;
+                std::memcpy(&block, p, sizeof(block));
+                if(!needs_escaping(block)) [[likely]] {
+                    continue;
+                }
+                for(const char* c = p; c < p + 8; c++) {
+                    handle(c);
+                }
+            }
+            for(; p < end; p++) {
+                handle(p);
+            }
+            out.append(run, end);
+            out.push_back('"');
+        }
+        // Writes an object key. Keys are not filtered, so escape everything JSON requires.
+        static void write_key(std::string& out, std::string_view s) {
+            constexpr char hex[] = "0123456789abcdef";
+            out.push_back('"');
+            const char* run = s.data();
+            for(const char* c = s.data(); c < s.data() + s.size(); c++) {
+                unsigned char ch = static_cast<unsigned char>(*c);
+                if(ch >= 0x20 && ch != '"' && ch != '\\') {
+                    continue;
+                }
+                out.append(run, c);
+                out.push_back('\\');
+                switch(ch) {
+                    case '"':  out.push_back('"'); break;
+                    case '\\': out.push_back('\\'); break;
+                    case '\n': out.push_back('n'); break;
+                    case '\r': out.push_back('r'); break;
+                    case '\t': out.push_back('t'); break;
+                    default:
+                        out.append("u00");
+                        out.push_back(hex[ch >> 4]);
+                        out.push_back(hex[ch & 0xf]);
+                }
+                run = c + 1;
+            }
+            out.append(run, s.data() + s.size());
+            out.push_back('"');
+        }
+
+        // True if any byte of the block is a control character, not ASCII, '"' or '\'.
+        static constexpr bool needs_escaping(std::uint64_t block) {
+            constexpr std::uint64_t ones = 0x0101010101010101ull;
+            constexpr std::uint64_t highs = 0x8080808080808080ull;
+            auto has_zero = [](std::uint64_t v) { return ((v - ones) & ~v & highs) != 0; };
+            bool high_bit = (block & highs) != 0;
+            bool control = ((block - ones * 0x20) & ~block & highs) != 0;
+            return high_bit || control
+                || has_zero(block ^ (ones * 0x7f)) || has_zero(block ^ (ones * '"')) || has_zero(block ^ (ones * '\\'));
+        }
+
+        // Attribute lists are short, so a linear scan is cheaper than hashing. Later duplicates win, like in jsonb.
+        static void add_key(std::vector<database::attribute_key>& keys, std::string_view name, database::json_type type) {
+            for(auto& key : keys) {
+                if(key.name == name) {
+                    key.type = type;
+                    return;
+                }
+            }
+            keys.emplace_back(name, type);
+        }
+};
+
+}
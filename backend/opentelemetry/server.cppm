@@ -1,13 +1,25 @@
 module;
+#include <algorithm>
+#include <atomic>
 #include <chrono>
+#include <cstdint>
+#include <expected>
+#include <filesystem>
+#include <format>
+#include <functional>
+#include <limits>
 #include <map>
 #include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
 #include <unordered_set>
+#include <vector>
 
 export module backend.opentelemetry;
 
 import glaze;
-import gzip;
 import pistache;
 import pqxx;
 import proto;
@@ -16,7 +28,10 @@ import spdlog;
 import common;
 import backend.utils;
 import backend.database;
-import backend.notifications;
+import backend.alerts;
+import backend.spool;
+import :decompression;
+import :json_writer;
 
 glz::generic to_json(const ::opentelemetry::proto::common::v1::AnyValue& v) {
     if(v.has_bool_value()) {
@@ -62,6 +77,9 @@ glz::generic::object_t to_json(const ::google::protobuf::RepeatedPtrField<::open
 namespace backend::opentelemetry {
     export class Server {
         public:
+            constexpr static std::size_t default_max_decompressed_size = 256 * 1024 * 1024;
+            constexpr static std::chrono::seconds retry_after{5};
+
             static Pistache::Address default_address() {
                 return Pistache::Address(Pistache::Ipv4::any(), Pistache::Port(4318));
             }
@@ -73,28 +91,44 @@ namespace backend::opentelemetry {
                     .flags(Pistache::Tcp::Options::ReuseAddr);
             }
 
-            Server(database::Database& db, NetworkIpFilter* ip_filter, Pistache::Address address = default_address(), Pistache::Http::Endpoint::Options options = default_options())
-                : db(db), ip_filter(ip_filter), address(address), server(address), router(), logger(spdlog::default_logger()->clone("opentelemetry"))
+            Server(database::Database& db, alerts::Dispatcher& alert_dispatcher, Pistache::Address address = default_address(), Pistache::Http::Endpoint::Options options = default_options())
+                : db(db), alert_dispatcher(alert_dispatcher), address(address), server(address), router(), logger(spdlog::default_logger()->clone("opentelemetry"))
             {
                 server.init(options);
 
                 router.post("/v1/logs", Pistache::Rest::Routes::bind(&Server::handle_log, this));
                 server.setHandler(router.handler());
 
-                auto f = db.queue_work([this](pqxx::connection& conn) {
-                    {
-                        pqxx::nontransaction txn(conn);
-                        alert_rules = this->db.get_alert_rules(txn);
-                    }
-
-                    conn.listen("alert_rules", [this](pqxx::notification notification){
-                        pqxx::nontransaction txn(notification.conn);
-                        alert_rules = this->db.get_alert_rules(txn);
-                        logger->info("Reloaded {} alert rule(s)", alert_rules.size());
-                    });
+                db.listen("alert_rules", [this](pqxx::notification notification){
+                    pqxx::nontransaction txn(notification.conn);
+                    load_alert_rules(txn);
+                    logger->info("Reloaded {} alert rule(s)", alert_rules.load()->rules.size());
+                });
+                db.listen("ingest_rules", [this](pqxx::notification notification){
+                    pqxx::nontransaction txn(notification.conn);
+                    load_ingest_rules(txn);
+                    logger->info("Reloaded {} ingest rule(s)", ingest_rules.load()->rules.size());
                 });
-                f.wait();
-                logger->info("Loaded {} alert rule(s)", alert_rules.size());
+                db.queue_work(database::work_class::ingest, [this](pqxx::connection& conn) {
+                    pqxx::nontransaction txn(conn);
+                    load_alert_rules(txn);
+                    load_ingest_rules(txn);
+                }).get();
+                logger->info("Loaded {} alert rule(s)", alert_rules.load()->rules.size());
+                logger->info("Loaded {} ingest rule(s)", ingest_rules.load()->rules.size());
+            }
+
+            // Limit for the size of compressed request bodies after decompression
+            void set_max_decompressed_size(std::size_t size) {
+                max_decompressed_size = size;
+            }
+
+            // Acknowledges requests once they are written to a spool in the given directory and inserts them in the background.
+            // Requests spooled before a restart are drained again, so this must be called before serving.
+            // Requests are rejected while more than max_size bytes wait to be drained, 0 means unlimited.
+            void enable_spool(const std::filesystem::path& directory, std::uint64_t max_size) {
+                spool = std::make_unique<spool::Spool>(directory, max_size);
+                spool->start(std::bind_front(&Server::drain_spooled, this));
             }
 
             void serve() {
@@ -106,38 +140,232 @@ namespace backend::opentelemetry {
                 server.serveThreaded();
             }
         private:
-            void process_alerts(pqxx::connection& conn, const common::log_entry& log, const common::log_resource& resource) {
-                pqxx::work txn(conn);
-                for(const auto& [_, rule] : alert_rules) {
-                    if(!rule.match(log)) {
-                        continue;
+            struct rule_set {
+                std::map<unsigned int, common::alert_rule> rules;
+                common::rule_matcher<common::alert_rule> matcher;
+
+                rule_set() = default;
+                explicit rule_set(std::map<unsigned int, common::alert_rule>&& r) : rules(std::move(r)), matcher(rules) {}
+                rule_set(const rule_set&) = delete;
+                rule_set& operator=(const rule_set&) = delete;
+            };
+
+            void load_alert_rules(pqxx::transaction_base& txn) {
+                auto rules = std::make_shared<const rule_set>(db.get_alert_rules(txn));
+                alert_dispatcher.load_rules(rules->rules);
+                alert_rules.store(std::move(rules));
+            }
+            void load_ingest_rules(pqxx::transaction_base& txn) {
+                ingest_rules.store(std::make_shared<const common::ingest_rule_set>(db.get_ingest_rules(txn),
+                    [this](const common::ingest_rule& rule, std::string_view error) {
+                        logger->warn("Disabling ingest rule {}:{}: {}", rule.id, rule.name, error);
+                    }));
+            }
+
+            static google::protobuf::ArenaOptions arena_options(std::size_t body_size) {
+                // decoded messages are larger than their wire format, so start with a block roughly the size of the body
+                constexpr std::size_t min_block_size = 4 * 1024;
+                constexpr std::size_t max_block_size = 1024 * 1024;
+                google::protobuf::ArenaOptions options;
+                options.start_block_size = std::clamp(body_size, min_block_size, max_block_size);
+                options.max_block_size = max_block_size;
+                return options;
+            }
+
+            // Matches the log against all alert rules. Notifications are sent by the dispatcher, so ingest does not wait for them.
+            void process_alerts(const std::shared_ptr<const rule_set>& rules,
+                const std::shared_ptr<const common::log_entry>& log, const std::shared_ptr<const common::log_resource>& resource)
+            {
+                rules->matcher.for_each_match(*log, [&](const common::alert_rule& rule) {
+                    alert_dispatcher.submit(alerts::alert_event{
+                        .rule = std::shared_ptr<const common::alert_rule>(rules, &rule),
+                        .resource = resource,
+                        .log = log
+                    });
+                });
+            }
+
+            using logs_request = ::opentelemetry::proto::collector::logs::v1::ExportLogsServiceRequest;
+
+            struct request_error {
+                Pistache::Http::Code code;
+                std::string message; // sent to the client
+                std::string detail;  // logged
+            };
+
+            static std::expected<std::optional<compression>, request_error> content_encoding(const Pistache::Rest::Request& request) {
+                if(!request.headers().has<Pistache::Http::Header::ContentEncoding>()) {
+                    return std::nullopt;
+                }
+                auto encoding = request.headers().get<Pistache::Http::Header::ContentEncoding>();
+                switch(encoding->encoding()) {
+                    case Pistache::Http::Header::Encoding::Identity:
+                        return std::nullopt;
+                    case Pistache::Http::Header::Encoding::Gzip:
+                        return compression::gzip;
+                    case Pistache::Http::Header::Encoding::Deflate:
+                        return compression::deflate;
+                    case Pistache::Http::Header::Encoding::Zstd:
+                        return compression::zstd;
+                    default:
+                        return std::unexpected(request_error{Pistache::Http::Code::Unsupported_Media_Type, "Unsupported Content-Encoding",
+                            std::format("Unsupported Content-Encoding: {}", Pistache::Http::Header::encodingString(encoding->encoding()))});
+                }
+            }
+
+            // Spooled requests store their encoding in a single byte: 0 for none, otherwise the compression algorithm plus one
+            static std::uint8_t spool_encoding(std::optional<compression> algorithm) {
+                return algorithm ? static_cast<std::uint8_t>(*algorithm) + 1 : 0;
+            }
+            static std::optional<compression> spool_compression(std::uint8_t encoding) {
+                if(encoding == 0) {
+                    return std::nullopt;
+                }
+                return static_cast<compression>(encoding - 1);
+            }
+
+            // Parses a request body onto the arena, so a large batch is a handful of block allocations instead of one per message and string.
+            std::expected<logs_request*, request_error> decode(google::protobuf::Arena& arena, std::string_view body, std::optional<compression> algorithm) const {
+                auto* req = google::protobuf::Arena::Create<logs_request>(&arena);
+                if(algorithm) {
+                    DecompressingStream stream(*algorithm, body, max_decompressed_size);
+                    bool parsed = req->ParseFromZeroCopyStream(&stream);
+                    // the stream ends early at the size limit or at corrupt data, which can still parse if it happens at a field boundary
+                    if(stream.limit_exceeded()) {
+                        return std::unexpected(request_error{Pistache::Http::Code::Request_Entity_Too_Large, "Decompressed request body too large",
+                            std::format("Decompressed request body exceeds {} bytes", max_decompressed_size)});
+                    } else if(stream.error_message()) {
+                        return std::unexpected(request_error{Pistache::Http::Code::Bad_Request, "Invalid compressed request body",
+                            std::format("Failed to decompress request body: {}", *stream.error_message())});
+                    } else if(!parsed) {
+                        return std::unexpected(request_error{Pistache::Http::Code::Bad_Request, "Invalid request body", "Failed to parse request body"});
                     }
+                } else if(body.size() > std::numeric_limits<int>::max() || !req->ParseFromArray(body.data(), static_cast<int>(body.size()))) {
+                    return std::unexpected(request_error{Pistache::Http::Code::Bad_Request, "Invalid request body", "Failed to parse request body"});
+                }
+                return req;
+            }
 
-                    logger->trace("Sending alert for rule {}:{}", rule.id, rule.name);
-                    common::alert_stencil_object msg{
-                        .rule = &rule,
-                        .resource = &resource,
-                        .log = &log
-                    };
-
-                    auto provider = notifications::registry::instance()
-                        .create_provider(rule.notification_provider, *logger, rule.notification_options);
-                    if(!provider) {
-                        logger->error("Failed to create notification provider {} for rule {}:{}: {}",
-                            rule.notification_provider, rule.id, rule.name, provider.error().message);
-                        txn.exec(pqxx::prepped{"update_alert_result"}, pqxx::params{rule.id, false, provider.error().message});
-                        continue;
+            // Applies the ingest rules to the logs of a request, inserts the ones which are kept and matches them against the alert rules.
+            // Requests drained from the spool derive adjusted timestamps from their position, so draining them again yields
+            // the same logs, and replays skip logs which were inserted before. Throws on database errors.
+            template<typename Source>
+            void process_request(pqxx::connection& conn, const logs_request& req, const Source& source, const spool::record* spooled = nullptr) {
+                using timestamp_t = std::chrono::time_point<std::chrono::system_clock, std::chrono::nanoseconds>;
+                std::unordered_set<decltype(std::declval<timestamp_t>().time_since_epoch().count())> seen_timestamps;
+                static uint64_t timestamp_fix_offset = 0;
+                uint64_t spooled_fix_offset = spooled ? spooled->pos.offset : 0;
+                uint64_t& fix_offset = spooled ? spooled_fix_offset : timestamp_fix_offset;
+
+                std::unordered_map<unsigned int, std::shared_ptr<const common::log_resource>> resources;
+                std::vector<database::log_row> rows;
+                std::vector<const ::opentelemetry::proto::logs::v1::LogRecord*> records;
+                std::vector<std::optional<common::log_entry>> entries; // only built when there are ingest rules to match
+                auto ingest = ingest_rules.load();
+                // logs of a request tend to look alike, so the JSON is written into buffers sized like the previous log's
+                std::size_t last_attributes_size = 0;
+                std::size_t last_body_size = 0;
+                for(auto& resourceLog : req.resource_logs()) {
+                    unsigned int resource = db.ensure_resource(conn, to_json(resourceLog.resource().attributes()));
+                    resources.try_emplace(resource, db.resources().get(resource));
+
+                    for(auto& scopeLog : resourceLog.scope_logs()) {
+                        for(auto& log : scopeLog.log_records()) {
+                            std::chrono::time_point<std::chrono::system_clock, std::chrono::nanoseconds> ts{std::chrono::nanoseconds(log.time_unix_nano())};
+                            // check if ts includes anything below seconds
+                            if(ts == std::chrono::floor<std::chrono::seconds>(ts)) {
+                                auto fixed_ts = ts + (std::chrono::microseconds(fix_offset++) % std::chrono::seconds(1));
+                                logger->warn("{} | Adjusted second-precision timestamp from {} to {}", source, ts.time_since_epoch().count(), fixed_ts.time_since_epoch().count());
+                                ts = fixed_ts;
+                            }
+
+                            while(seen_timestamps.contains(ts.time_since_epoch().count())) {
+                                ts += std::chrono::microseconds(1);
+                            }
+                            seen_timestamps.insert(ts.time_since_epoch().count());
+
+                            auto severity = static_cast<common::log_severity>(log.severity_number());
+                            auto& entry = entries.emplace_back();
+                            common::ingest_result result = common::ingest_result::keep;
+                            if(!ingest->matcher.empty()) {
+                                entry = common::log_entry{
+                                    .resource = resource,
+                                    .timestamp = std::chrono::time_point_cast<std::chrono::duration<double>>(ts).time_since_epoch().count(),
+                                    .scope = scopeLog.scope().name(),
+                                    .severity = severity,
+                                    .attributes = to_json(log.attributes()),
+                                    .body = to_json(log.body())
+                                };
+                                result = ingest->apply(*entry, [this](const common::ingest_rule& rule, std::string_view error) {
+                                    logger->warn("Error applying stencil for transform action in ingest rule {}:{}: {}", rule.id, rule.name, error);
+                                });
+                            }
+                            if(result == common::ingest_result::drop) {
+                                entries.pop_back();
+                                continue;
+                            }
+
+                            auto& row = rows.emplace_back(resource, ts, scopeLog.scope().name(), severity);
+                            if(result == common::ingest_result::transformed) {
+                                row.attributes = glz::write_json(entry->attributes).value_or("{}");
+                                row.attribute_keys = database::attribute_keys(entry->attributes);
+                            } else {
+                                row.attributes.reserve(last_attributes_size);
+                                JsonWriter::write_attributes(row.attributes, log.attributes(), row.attribute_keys);
+                            }
+                            row.body.reserve(last_body_size);
+                            JsonWriter::write_value(row.body, log.body());
+                            last_attributes_size = row.attributes.size();
+                            last_body_size = row.body.size();
+                            records.push_back(&log);
+                        }
                     }
-                    auto result = (*provider)->notify(*logger, msg, ip_filter);
-                    if(!result) {
-                        logger->error("Failed to send notification for rule {}:{}: {}",
-                            rule.id, rule.name, result.error().message);
-                        txn.exec(pqxx::prepped{"update_alert_result"}, pqxx::params{rule.id, false, result.error().message});
-                        continue;
+                }
+                if(rows.empty()) {
+                    return;
+                }
+                auto written = db.insert_logs(conn, rows, spooled && spooled->replay);
+
+                // only build the glz::generic representation if there is a rule that could look at it
+                auto rules = alert_rules.load();
+                if(!rules->matcher.empty()) {
+                    for(std::size_t i = 0; i < rows.size(); i++) {
+                        if(!written[i]) {
+                            continue; // alerts for it were sent when it was written
+                        }
+                        auto& row = rows[i];
+                        std::shared_ptr<const common::log_entry> log_entry;
+                        if(entries[i]) {
+                            // the timestamp might have been shifted while inserting
+                            entries[i]->timestamp = std::chrono::time_point_cast<std::chrono::duration<double>>(row.timestamp).time_since_epoch().count();
+                            log_entry = std::make_shared<const common::log_entry>(std::move(*entries[i]));
+                        } else {
+                            log_entry = std::make_shared<const common::log_entry>(common::log_entry{
+                                .resource = row.resource,
+                                .timestamp = std::chrono::time_point_cast<std::chrono::duration<double>>(row.timestamp).time_since_epoch().count(),
+                                .scope = std::move(row.scope),
+                                .severity = row.severity,
+                                .attributes = to_json(records[i]->attributes()),
+                                .body = to_json(records[i]->body())
+                            });
+                        }
+                        process_alerts(rules, log_entry, resources.at(row.resource));
                     }
-                    txn.exec(pqxx::prepped{"update_alert_result"}, pqxx::params{rule.id, true, std::nullopt});
                 }
-                txn.commit();
+            }
+
+            // Called by the spool for every request it drains. Only database errors are worth retrying.
+            bool drain_spooled(const spool::record& request) {
+                google::protobuf::Arena arena(arena_options(request.body.size()));
+                auto req = decode(arena, request.body, spool_compression(request.encoding));
+                if(!req) {
+                    logger->error("spool | Dropping invalid spooled request: {}", req.error().detail);
+                    return true;
+                }
+                db.queue_work(database::work_class::ingest, [&](pqxx::connection& conn) {
+                    process_request(conn, **req, "spool", &request);
+                }).get();
+                return true;
             }
 
             Pistache::Rest::Route::Result handle_log(const Pistache::Rest::Request& request, Pistache::Http::ResponseWriter response) {
@@ -155,76 +383,63 @@ namespace backend::opentelemetry {
                         return Pistache::Rest::Route::Result::Failure;
                     }
 
-                    std::string body;
-                    if(request.headers().has<Pistache::Http::Header::ContentEncoding>()) {
-                        auto encoding = request.headers().get<Pistache::Http::Header::ContentEncoding>();
-                        if(encoding->encoding() == Pistache::Http::Header::Encoding::Gzip) {
-                            body = gzip::decompress(request.body().data(), request.body().size());
-                        } else {
-                            logger->warn("{} | Unsupported Content-Encoding: {}", request.address(), Pistache::Http::Header::encodingString(encoding->encoding()));
-                            response.send(Pistache::Http::Code::Unsupported_Media_Type, "Unsupported Content-Encoding");
+                    auto algorithm = content_encoding(request);
+                    if(!algorithm) {
+                        logger->warn("{} | {}", request.address(), algorithm.error().detail);
+                        response.send(algorithm.error().code, algorithm.error().message);
+                        return Pistache::Rest::Route::Result::Failure;
+                    }
+
+                    // The raw body is acknowledged as soon as it is on disk, inserting happens when it is drained.
+                    // It is parsed once before, so requests which could never be inserted are rejected instead of acknowledged.
+                    if(spool) {
+                        google::protobuf::Arena arena(arena_options(request.body().size()));
+                        if(auto req = decode(arena, request.body(), *algorithm); !req) {
+                            logger->warn("{} | {}", request.address(), req.error().detail);
+                            response.send(req.error().code, req.error().message);
                             return Pistache::Rest::Route::Result::Failure;
                         }
-                    } else {
-                        body = request.body();
+                        switch(spool->append(spool_encoding(*algorithm), request.body())) {
+                            case spool::append_result::ok:
+                                response.send(Pistache::Http::Code::Ok, "");
+                                return Pistache::Rest::Route::Result::Ok;
+                            case spool::append_result::full:
+                                logger->warn("{} | Spool is full, rejecting request", request.address());
+                                response.headers().add<Pistache::Http::Header::RetryAfter>(retry_after);
+                                response.send(Pistache::Http::Code::Service_Unavailable, "Spool is full, retry later");
+                                return Pistache::Rest::Route::Result::Failure;
+                            case spool::append_result::failed:
+                                logger->error("{} | Failed to write request to spool", request.address());
+                                response.headers().add<Pistache::Http::Header::RetryAfter>(retry_after);
+                                response.send(Pistache::Http::Code::Service_Unavailable, "Spool unavailable, retry later");
+                                return Pistache::Rest::Route::Result::Failure;
+                        }
                     }
 
-                    ::opentelemetry::proto::collector::logs::v1::ExportLogsServiceRequest req;
-                    if(!req.ParseFromString(body)) {
-                        logger->warn("{} | Failed to parse request body", request.address());
-                        response.send(Pistache::Http::Code::Bad_Request, "Invalid request body");
+                    // reject before decompressing and parsing, so a slow database does not make us pile up requests in memory
+                    if(!db.admit_work()) {
+                        logger->warn("{} | Database work queue is full, rejecting request", request.address());
+                        response.headers().add<Pistache::Http::Header::RetryAfter>(retry_after);
+                        response.send(Pistache::Http::Code::Too_Many_Requests, "Too many requests, retry later");
                         return Pistache::Rest::Route::Result::Failure;
                     }
 
-                    db.queue_work([this, address = request.address(), req = std::move(req), response = std::move(response)](pqxx::connection& conn) mutable {
-                        try {
-                            using timestamp_t = std::chrono::time_point<std::chrono::system_clock, std::chrono::nanoseconds>;
-                            std::unordered_set<decltype(std::declval<timestamp_t>().time_since_epoch().count())> seen_timestamps;
-                            static uint64_t timestamp_fix_offset = 0;
-
-                            for(auto& resourceLog : req.resource_logs()) {
-                                glz::generic::object_t resource_attributes = to_json(resourceLog.resource().attributes());
-                                unsigned int resource = db.ensure_resource(conn, resource_attributes);
-                                common::log_resource log_resource{
-                                    .id = resource,
-                                    .attributes = std::move(resource_attributes),
-                                };
+                    // The parsed request and everything in it lives on an arena owned by the queued work item.
+                    const std::string& body = request.body();
+                    auto arena = std::make_unique<google::protobuf::Arena>(arena_options(body.size()));
+                    auto req = decode(*arena, body, *algorithm);
+                    if(!req) {
+                        logger->warn("{} | {}", request.address(), req.error().detail);
+                        response.send(req.error().code, req.error().message);
+                        return Pistache::Rest::Route::Result::Failure;
+                    }
 
-                                for(auto& scopeLog : resourceLog.scope_logs()) {
-                                    for(auto& log : scopeLog.log_records()) {
-                                        std::chrono::time_point<std::chrono::system_clock, std::chrono::nanoseconds> ts{std::chrono::nanoseconds(log.time_unix_nano())};
-                                        // check if ts includes anything below seconds
-                                        if(ts == std::chrono::floor<std::chrono::seconds>(ts)) {
-                                            auto fixed_ts = ts + (std::chrono::microseconds(timestamp_fix_offset++) % std::chrono::seconds(1));
-                                            logger->warn("{} | Adjusted second-precision timestamp from {} to {}", address, ts.time_since_epoch().count(), fixed_ts.time_since_epoch().count());
-                                            ts = fixed_ts;
-                                        }
-
-                                        while(seen_timestamps.contains(ts.time_since_epoch().count())) {
-                                            ts += std::chrono::microseconds(1);
-                                        }
-                                        seen_timestamps.insert(ts.time_since_epoch().count());
-
-                                        glz::generic::object_t attributes = to_json(log.attributes());
-                                        glz::generic body = to_json(log.body());
-                                        common::log_severity severity = static_cast<common::log_severity>(log.severity_number());
-                                        db.insert_log(conn, resource, ts, scopeLog.scope().name(), severity, attributes, body);
-
-                                        common::log_entry log_entry{
-                                            .resource = resource,
-                                            .timestamp = std::chrono::time_point_cast<std::chrono::duration<double>>(ts).time_since_epoch().count(),
-                                            .scope = scopeLog.scope().name(),
-                                            .severity = severity,
-                                            .attributes = std::move(attributes),
-                                            .body = std::move(body)
-                                        };
-                                        process_alerts(conn, log_entry, log_resource);
-                                    }
-                                }
-                            }
+                    db.queue_work(database::work_class::ingest, [this, address = request.address(), arena = std::move(arena), req = *req, response = std::move(response)](pqxx::connection& conn) mutable {
+                        try {
+                            process_request(conn, *req, address);
                             response.send(Pistache::Http::Code::Ok, "");
                         } catch(const std::exception& e) {
-                            logger->error("{} | Unhandled exception: {} for request {}", address, e.what(), req.DebugString());
+                            logger->error("{} | Unhandled exception: {} for request {}", address, e.what(), req->DebugString());
                             response.send(Pistache::Http::Code::Internal_Server_Error, "Internal server error");
                         }
                     });
@@ -239,8 +454,13 @@ namespace backend::opentelemetry {
             Pistache::Http::Endpoint server;
             Pistache::Rest::Router router;
             database::Database& db;
-            NetworkIpFilter* ip_filter;
+            alerts::Dispatcher& alert_dispatcher;
+            std::size_t max_decompressed_size = default_max_decompressed_size;
+
+            std::atomic<std::shared_ptr<const rule_set>> alert_rules = std::make_shared<const rule_set>();
+            std::atomic<std::shared_ptr<const common::ingest_rule_set>> ingest_rules = std::make_shared<const common::ingest_rule_set>();
 
-            std::map<unsigned int, common::alert_rule> alert_rules;
+            // declared last, so draining stops before anything it uses is destroyed
+            std::unique_ptr<spool::Spool> spool;
     };
 }
@@ -3,6 +3,7 @@ module;
 #include "opentelemetry/proto/collector/logs/v1/logs_service.pb.h"
 #include "opentelemetry/proto/logs/v1/logs.pb.h"
 #include "opentelemetry/proto/common/v1/common.pb.h"
+#include <google/protobuf/io/zero_copy_stream.h>
 
 export module proto;
 
@@ -14,6 +15,7 @@ export namespace opentelemetry::proto {
     }
     namespace logs::v1 {
         using opentelemetry::proto::logs::v1::ResourceLogs;
+        using opentelemetry::proto::logs::v1::LogRecord;
     }
     namespace common::v1 {
         using opentelemetry::proto::common::v1::AnyValue;
@@ -25,5 +27,10 @@ export namespace opentelemetry::proto {
 export namespace google {
     namespace protobuf {
         using google::protobuf::RepeatedPtrField;
+        using google::protobuf::Arena;
+        using google::protobuf::ArenaOptions;
+        namespace io {
+            using google::protobuf::io::ZeroCopyInputStream;
+        }
     }
 }
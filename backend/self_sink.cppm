@@ -72,7 +72,7 @@ template <typename Mutex>
 class self_sink : public spdlog::sinks::base_sink<Mutex> {
     public:
         self_sink(database::Database& db) : m_db(db) {
-            m_resource_future = m_db.queue_work([this](pqxx::connection& conn){
+            m_resource_future = m_db.queue_work(database::work_class::ingest, [this](pqxx::connection& conn){
                 glz::generic attributes{
                     {"service.name", service_name},
                     {"service.version", service_version},
@@ -114,7 +114,7 @@ class self_sink : public spdlog::sinks::base_sink<Mutex> {
             if(m_resource_future.valid()) { // make sure the resource exists here
                 m_resource_future.get();
             }
-            m_db.queue_work([this, attributes = std::move(attributes), body = std::move(body), severity, timestamp](pqxx::connection& conn){
+            m_db.queue_work(database::work_class::ingest, [this, attributes = std::move(attributes), body = std::move(body), severity, timestamp](pqxx::connection& conn){
                 try {
                     m_db.insert_log(conn, m_resource_id, timestamp, scope, severity, attributes, body);
                 } catch(const std::exception& e) {
@@ -0,0 +1,453 @@
+module;
+#include <algorithm>
+#include <cerrno>
+#include <charconv>
+#include <chrono>
+#include <cstddef>
+#include <cstring>
+#include <filesystem>
+#include <format>
+#include <limits>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zlib.h>
+
+module backend.spool;
+
+import spdlog;
+
+namespace backend::spool {
+
+namespace {
+    struct checkpoint_data {
+        std::uint64_t segment;
+        std::uint64_t offset;
+        std::uint32_t crc;
+        std::uint32_t reserved;
+    };
+    static_assert(sizeof(checkpoint_data) == 24);
+
+    std::uint32_t checksum(const void* data, std::size_t size, uLong crc = crc32(0L, Z_NULL, 0)) {
+        return crc32_z(crc, static_cast<const Bytef*>(data), size);
+    }
+
+    [[noreturn]] void throw_errno(std::string_view what) {
+        throw std::system_error(errno, std::generic_category(), std::string{what});
+    }
+
+    // Returns false if the file ended before size bytes could be read.
+    bool read_fully(int fd, void* data, std::size_t size, std::uint64_t offset) {
+        auto* p = static_cast<char*>(data);
+        while(size > 0) {
+            ssize_t n = pread(fd, p, size, static_cast<off_t>(offset));
+            if(n < 0) {
+                if(errno == EINTR) continue;
+                throw_errno("Failed to read spool segment");
+            }
+            if(n == 0) {
+                return false;
+            }
+            p += n;
+            size -= n;
+            offset += n;
+        }
+        return true;
+    }
+    void write_fully(int fd, const char* data, std::size_t size) {
+        while(size > 0) {
+            ssize_t n = write(fd, data, size);
+            if(n < 0) {
+                if(errno == EINTR) continue;
+                throw_errno("Failed to write spool segment");
+            }
+            data += n;
+            size -= n;
+        }
+    }
+    std::uint64_t file_size(int fd) {
+        struct stat st{};
+        if(fstat(fd, &st) != 0) {
+            throw_errno("Failed to stat spool segment");
+        }
+        return static_cast<std::uint64_t>(st.st_size);
+    }
+    // Makes creating and removing files in the directory durable
+    void sync_directory(const std::filesystem::path& directory) {
+        int fd = open(directory.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if(fd < 0) {
+            throw_errno("Failed to open spool directory");
+        }
+        fsync(fd);
+        close(fd);
+    }
+}
+
+Spool::Spool(std::filesystem::path directory, std::uint64_t max_size)
+    : directory(std::move(directory)), max_size(max_size), logger(spdlog::default_logger()->clone("spool"))
+{
+    std::filesystem::create_directories(this->directory);
+
+    auto segments = list_segments();
+    if(segments.empty()) {
+        segments.push_back(1);
+    }
+    durable = {segments.back(), recover_segment(segments.back())};
+    recovered = durable;
+    open_segment(segments.back());
+
+    checkpoint_fd = open((this->directory / "checkpoint").c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if(checkpoint_fd < 0) {
+        throw_errno("Failed to open spool checkpoint");
+    }
+    auto checkpoint = read_checkpoint();
+    if(checkpoint && checkpoint->segment >= segments.front() && *checkpoint <= durable) {
+        drained = *checkpoint;
+    } else {
+        if(checkpoint) {
+            logger->warn("Spool checkpoint {}:{} does not match the segments on disk, draining everything", checkpoint->segment, checkpoint->offset);
+        }
+        drained = {segments.front(), 0};
+    }
+
+    for(auto segment : segments) {
+        if(segment < drained.segment) {
+            std::filesystem::remove(segment_path(segment));
+            continue;
+        }
+        std::uint64_t size = segment == durable.segment ? durable.offset : std::filesystem::file_size(segment_path(segment));
+        backlog_bytes += size - (segment == drained.segment ? drained.offset : 0);
+    }
+    logger->info("Opened spool in {} with {} byte(s) left to drain", this->directory.string(), backlog_bytes);
+    if(max_size > 0 && backlog_bytes > max_size) {
+        logger->warn("Spool backlog exceeds its limit of {} byte(s), rejecting requests until it is drained", max_size);
+    }
+}
+
+Spool::~Spool() {
+    // stop the threads before closing the files they use
+    drainer = std::jthread{};
+    writer = std::jthread{};
+    if(segment_fd >= 0) {
+        close(segment_fd);
+    }
+    if(checkpoint_fd >= 0) {
+        close(checkpoint_fd);
+    }
+}
+
+void Spool::start(drain_handler handler) {
+    writer = std::jthread(std::bind(&Spool::writer_thread, this, std::placeholders::_1));
+    pthread_setname_np(writer.native_handle(), "spool-writer");
+    drainer = std::jthread(std::bind(&Spool::drain_thread, this, std::placeholders::_1, std::move(handler)));
+    pthread_setname_np(drainer.native_handle(), "spool-drainer");
+}
+
+append_result Spool::append(std::uint8_t encoding, std::string_view body) {
+    if(body.size() > std::numeric_limits<std::uint32_t>::max()) {
+        return append_result::failed;
+    }
+    record_header header{
+        .magic = record_magic,
+        .size = static_cast<std::uint32_t>(body.size()),
+        .crc = checksum(body.data(), body.size(), checksum(&encoding, 1)),
+        .encoding = encoding,
+        .reserved = {}
+    };
+
+    std::unique_lock lock(mutex);
+    if(failed) {
+        return append_result::failed;
+    }
+    // the batch being written is in neither, so the limit may be overshot by that much
+    if(max_size > 0 && backlog_bytes + pending.size() + sizeof(header) + body.size() > max_size) {
+        return append_result::full;
+    }
+    pending.insert(pending.end(), reinterpret_cast<const char*>(&header), reinterpret_cast<const char*>(&header) + sizeof(header));
+    pending.insert(pending.end(), body.begin(), body.end());
+    std::uint64_t ticket = ++appended;
+    write_cv.notify_one();
+
+    synced_cv.wait(lock, [&] { return synced >= ticket || failed; });
+    return synced >= ticket ? append_result::ok : append_result::failed;
+}
+
+std::uint64_t Spool::backlog() const {
+    std::unique_lock lock(mutex);
+    return backlog_bytes;
+}
+
+std::filesystem::path Spool::segment_path(std::uint64_t segment) const {
+    return directory / std::format("{:016x}.segment", segment);
+}
+
+std::vector<std::uint64_t> Spool::list_segments() const {
+    std::vector<std::uint64_t> segments;
+    for(const auto& entry : std::filesystem::directory_iterator(directory)) {
+        if(!entry.is_regular_file() || entry.path().extension() != ".segment") {
+            continue;
+        }
+        std::string stem = entry.path().stem().string();
+        std::uint64_t segment{};
+        auto [end, ec] = std::from_chars(stem.data(), stem.data() + stem.size(), segment, 16);
+        if(ec == std::errc{} && end == stem.data() + stem.size()) {
+            segments.push_back(segment);
+        }
+    }
+    std::ranges::sort(segments);
+    return segments;
+}
+
+// Finds the end of the last complete record and cuts off anything after it, which is left over from a crash during a write.
+std::uint64_t Spool::recover_segment(std::uint64_t segment) {
+    int fd = open(segment_path(segment).c_str(), O_RDWR | O_CLOEXEC);
+    if(fd < 0) {
+        if(errno == ENOENT) {
+            return 0;
+        }
+        throw_errno("Failed to open spool segment");
+    }
+
+    std::uint64_t size = file_size(fd);
+    std::uint64_t offset = 0;
+    std::vector<char> buffer;
+    while(true) {
+        record_header header;
+        if(!read_fully(fd, &header, sizeof(header), offset)) {
+            break;
+        }
+        if(header.magic != record_magic || offset + sizeof(header) + header.size > size) {
+            break;
+        }
+        buffer.resize(header.size);
+        if(!read_fully(fd, buffer.data(), buffer.size(), offset + sizeof(header))) {
+            break;
+        }
+        if(checksum(buffer.data(), buffer.size(), checksum(&header.encoding, 1)) != header.crc) {
+            break;
+        }
+        offset += sizeof(header) + header.size;
+    }
+
+    if(offset < size) {
+        logger->warn("Truncating spool segment {} from {} to {} bytes after an incomplete write", segment, size, offset);
+        if(ftruncate(fd, static_cast<off_t>(offset)) != 0 || fsync(fd) != 0) {
+            close(fd);
+            throw_errno("Failed to truncate spool segment");
+        }
+    }
+    close(fd);
+    return offset;
+}
+
+void Spool::open_segment(std::uint64_t segment) {
+    int fd = open(segment_path(segment).c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if(fd < 0) {
+        throw_errno("Failed to open spool segment");
+    }
+    sync_directory(directory);
+    if(segment_fd >= 0) {
+        close(segment_fd);
+    }
+    segment_fd = fd;
+}
+
+std::optional<position> Spool::read_checkpoint() {
+    checkpoint_data data{};
+    if(!read_fully(checkpoint_fd, &data, sizeof(data), 0)) {
+        return std::nullopt;
+    }
+    if(checksum(&data, offsetof(checkpoint_data, crc)) != data.crc) {
+        return std::nullopt;
+    }
+    return position{data.segment, data.offset};
+}
+
+void Spool::write_checkpoint(const position& pos, bool sync) {
+    checkpoint_data data{pos.segment, pos.offset, 0, 0};
+    data.crc = checksum(&data, offsetof(checkpoint_data, crc));
+    if(pwrite(checkpoint_fd, &data, sizeof(data), 0) != sizeof(data)) {
+        throw_errno("Failed to write spool checkpoint");
+    }
+    if(sync) {
+        fdatasync(checkpoint_fd);
+    }
+}
+
+// Writes appended requests in batches, so concurrent requests share one fdatasync.
+void Spool::writer_thread(std::stop_token st) {
+    while(true) {
+        std::vector<char> batch;
+        std::uint64_t ticket;
+        {
+            std::unique_lock lock(mutex);
+            write_cv.wait(lock, st, [this] { return !pending.empty(); });
+            if(pending.empty()) {
+                break; // stop was requested and everything is written
+            }
+            batch.swap(pending);
+            ticket = appended;
+        }
+
+        try {
+            position end = durable; // only ever changed by this thread
+            if(end.offset > 0 && end.offset + batch.size() > max_segment_size) {
+                open_segment(end.segment + 1);
+                end = {end.segment + 1, 0};
+            }
+            write_fully(segment_fd, batch.data(), batch.size());
+            if(fdatasync(segment_fd) != 0) {
+                throw_errno("Failed to sync spool segment");
+            }
+            end.offset += batch.size();
+
+            std::unique_lock lock(mutex);
+            synced = ticket;
+            durable = end;
+            backlog_bytes += batch.size();
+        } catch(const std::exception& e) {
+            logger->critical("Failed to write to spool, rejecting further requests: {}", e.what());
+            std::unique_lock lock(mutex);
+            failed = true;
+        }
+        synced_cv.notify_all();
+        drain_cv.notify_all();
+    }
+
+    std::unique_lock lock(mutex);
+    failed = true; // nothing will be written anymore
+    synced_cv.notify_all();
+}
+
+void Spool::drain_thread(std::stop_token st, drain_handler handler) {
+    int fd = -1;
+    std::uint64_t fd_segment = 0;
+    std::vector<char> buffer;
+    auto retry_delay = std::chrono::seconds(1);
+    bool retrying = false;
+    auto last_sync = std::chrono::steady_clock::now();
+    bool checkpoint_dirty = false;
+
+    position pos;
+    {
+        std::unique_lock lock(mutex);
+        pos = drained;
+    }
+
+    // The checkpoint is written after every record, but only synced once in a while.
+    auto advance = [&](position next, std::uint64_t bytes, bool force_sync) {
+        bool sync = force_sync || std::chrono::steady_clock::now() - last_sync >= checkpoint_sync_interval;
+        write_checkpoint(next, sync);
+        checkpoint_dirty = !sync;
+        if(sync) {
+            last_sync = std::chrono::steady_clock::now();
+        }
+        pos = next;
+        std::unique_lock lock(mutex);
+        drained = pos;
+        backlog_bytes -= bytes;
+    };
+
+    while(!st.stop_requested()) {
+        try {
+            position end;
+            {
+                std::unique_lock lock(mutex);
+                drain_cv.wait_for(lock, st, checkpoint_sync_interval, [&] { return pos < durable; });
+                if(st.stop_requested()) {
+                    break;
+                }
+                end = durable;
+            }
+            if(!(pos < end)) {
+                if(checkpoint_dirty) {
+                    write_checkpoint(pos, true);
+                    last_sync = std::chrono::steady_clock::now();
+                    checkpoint_dirty = false;
+                }
+                continue;
+            }
+
+            if(fd < 0 || fd_segment != pos.segment) {
+                if(fd >= 0) {
+                    close(fd);
+                }
+                fd = open(segment_path(pos.segment).c_str(), O_RDONLY | O_CLOEXEC);
+                fd_segment = pos.segment;
+                if(fd < 0) {
+                    throw_errno("Failed to open spool segment for draining");
+                }
+            }
+            std::uint64_t limit = pos.segment == end.segment ? end.offset : file_size(fd);
+
+            if(pos.offset >= limit) {
+                // a completed segment was drained entirely
+                close(fd);
+                fd = -1;
+                std::filesystem::remove(segment_path(pos.segment));
+                advance({pos.segment + 1, 0}, 0, true);
+                continue;
+            }
+
+            record_header header;
+            bool valid = read_fully(fd, &header, sizeof(header), pos.offset)
+                && header.magic == record_magic && pos.offset + sizeof(header) + header.size <= limit;
+            if(valid) {
+                buffer.resize(header.size);
+                valid = read_fully(fd, buffer.data(), buffer.size(), pos.offset + sizeof(header))
+                    && checksum(buffer.data(), buffer.size(), checksum(&header.encoding, 1)) == header.crc;
+            }
+            if(!valid) {
+                logger->error("Corrupt record in spool segment {} at offset {}, skipping {} byte(s)", pos.segment, pos.offset, limit - pos.offset);
+                advance({pos.segment, limit}, limit - pos.offset, false);
+                continue;
+            }
+
+            bool handled = false;
+            try {
+                handled = handler(record{
+                    .pos = pos,
+                    .encoding = header.encoding,
+                    .body = std::string_view{buffer.data(), buffer.size()},
+                    .replay = retrying || pos < recovered
+                });
+            } catch(const std::exception& e) {
+                logger->error("Failed to drain spooled request: {}", e.what());
+            }
+            if(!handled) {
+                retrying = true;
+                logger->warn("Retrying spooled request in {} seconds", retry_delay.count());
+                std::unique_lock lock(mutex);
+                drain_cv.wait_for(lock, st, retry_delay, [] { return false; }); // only woken up early to stop
+                retry_delay = std::min(retry_delay * 2, std::chrono::duration_cast<std::chrono::seconds>(max_retry_delay));
+                continue;
+            }
+            retry_delay = std::chrono::seconds(1);
+            retrying = false;
+            advance({pos.segment, pos.offset + sizeof(header) + header.size}, sizeof(header) + header.size, false);
+        } catch(const std::exception& e) {
+            logger->error("Error while draining spool: {}", e.what());
+            retrying = true; // the request might have been handled before the error
+            std::unique_lock lock(mutex);
+            drain_cv.wait_for(lock, st, max_retry_delay, [] { return false; });
+        }
+    }
+
+    if(fd >= 0) {
+        close(fd);
+    }
+    try {
+        write_checkpoint(pos, true);
+    } catch(const std::exception& e) {
+        logger->error("Failed to write spool checkpoint: {}", e.what());
+    }
+}
+
+}
@@ -0,0 +1,118 @@
+module;
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+export module backend.spool;
+
+import spdlog;
+
+namespace backend::spool {
+
+// Location of a record in the spool
+export struct position {
+    std::uint64_t segment;
+    std::uint64_t offset;
+
+    auto operator<=>(const position&) const = default;
+};
+
+// A spooled request, as handed to the drain handler
+export struct record {
+    position pos;
+    std::uint8_t encoding;
+    std::string_view body;
+    // Whether the request might have been drained before, by a run which stopped before its checkpoint was synced
+    // or by an attempt which failed. Handlers use this to make draining it again idempotent.
+    bool replay;
+};
+
+export enum class append_result {
+    ok,
+    full,  // the backlog reached its limit
+    failed // the spool could not be written
+};
+
+// Durable write-ahead spool for raw ingest requests.
+// Requests are appended to segment files and acknowledged as soon as they are on disk. A background thread hands them
+// to the drain handler in order and records its progress in a checkpoint file, so after a crash draining resumes from
+// the last checkpoint. Requests may thus be drained more than once, but are never lost.
+// The backlog is bounded, so a database outage cannot fill up the disk.
+export class Spool {
+    public:
+        constexpr static std::uint64_t max_segment_size = 64 * 1024 * 1024;
+
+        // Called for every spooled request. Returning false or throwing means the request should be retried later.
+        using drain_handler = std::function<bool(const record& request)>;
+
+        // max_size limits the bytes appended but not drained yet, 0 means unlimited.
+        Spool(std::filesystem::path directory, std::uint64_t max_size = 0);
+        ~Spool();
+        Spool(const Spool&) = delete;
+        Spool& operator=(const Spool&) = delete;
+
+        void start(drain_handler handler);
+
+        // Blocks until the request is durable.
+        append_result append(std::uint8_t encoding, std::string_view body);
+
+        // Number of bytes appended, but not drained yet
+        std::uint64_t backlog() const;
+    private:
+        constexpr static std::uint32_t record_magic = 0x43534c31; // "CSL1"
+        constexpr static auto checkpoint_sync_interval = std::chrono::seconds(1);
+        constexpr static auto max_retry_delay = std::chrono::seconds(30);
+
+        struct record_header {
+            std::uint32_t magic;
+            std::uint32_t size;
+            std::uint32_t crc;
+            std::uint8_t encoding;
+            std::uint8_t reserved[3];
+        };
+        static_assert(sizeof(record_header) == 16);
+
+        std::filesystem::path segment_path(std::uint64_t segment) const;
+        std::vector<std::uint64_t> list_segments() const;
+        std::uint64_t recover_segment(std::uint64_t segment);
+        void open_segment(std::uint64_t segment);
+        std::optional<position> read_checkpoint();
+        void write_checkpoint(const position& pos, bool sync);
+
+        void writer_thread(std::stop_token st);
+        void drain_thread(std::stop_token st, drain_handler handler);
+
+        std::filesystem::path directory;
+        std::uint64_t max_size;
+        std::shared_ptr<spdlog::logger> logger;
+
+        mutable std::mutex mutex;
+        std::condition_variable_any write_cv;  // new data to write
+        std::condition_variable_any synced_cv; // data was written
+        std::condition_variable_any drain_cv;  // new durable data to drain
+        std::vector<char> pending;
+        std::uint64_t appended = 0; // records appended
+        std::uint64_t synced = 0;   // records on disk
+        bool failed = false;
+        position durable{};  // end of the data on disk
+        position drained{};  // start of the data not drained yet
+        position recovered{}; // end of the data on disk when the spool was opened, anything before it might have been drained already
+        std::uint64_t backlog_bytes = 0;
+
+        int segment_fd = -1;     // segment currently written to
+        int checkpoint_fd = -1;
+
+        // declared last, so they are stopped before anything they use is destroyed
+        std::jthread writer;
+        std::jthread drainer;
+};
+
+}
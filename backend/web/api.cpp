@@ -1,8 +1,12 @@
 module;
 #include <algorithm>
+#include <charconv>
 #include <chrono>
+#include <cmath>
+#include <cstdint>
 #include <expected>
 #include <format>
+#include <optional>
 #include <ranges>
 #include <string>
 #include <unordered_map>
@@ -95,7 +99,32 @@ struct query_parameters {
     std::optional<std::variant<std::vector<std::string>, all_attributes>> attributes; // NOT escaped yet!
     std::vector<std::string> scopes; // NOT escaped yet!
     std::vector<unsigned int> resources;
+    // time bounds in unix seconds, so PostgreSQL only has to look at the partitions covering them
+    std::optional<double> from;
+    std::optional<double> to;
+    std::optional<unsigned int> since; // seconds before now
+    std::optional<common::log_severity> severity_min;
+    std::optional<common::log_cursor> after; // only return rows after this one
 };
+std::optional<double> parse_timestamp(std::string_view sv) {
+    double d{};
+    auto [end, ec] = std::from_chars(sv.data(), sv.data() + sv.size(), d);
+    if(ec != std::errc{} || end != sv.data() + sv.size() || !std::isfinite(d)) {
+        return std::nullopt;
+    }
+    return d;
+}
+std::optional<common::log_severity> parse_severity(std::string_view sv) {
+    if(auto it = std::ranges::find(common::log_severity_names, sv); it != common::log_severity_names.end()) {
+        return static_cast<common::log_severity>(std::distance(common::log_severity_names.begin(), it));
+    }
+    unsigned int number{};
+    auto [end, ec] = std::from_chars(sv.data(), sv.data() + sv.size(), number);
+    if(ec == std::errc{} && end == sv.data() + sv.size() && number < common::log_severity_names.size()) {
+        return static_cast<common::log_severity>(number);
+    }
+    return std::nullopt;
+}
 query_parameters parse_parameters(const Pistache::Rest::Request& request) {
     constexpr auto url_decode = [](std::string_view sv) -> std::string { return glz::url_decode(sv); };
     auto attributes = request.query().get("attributes").transform(url_decode);
@@ -103,6 +132,11 @@ query_parameters parse_parameters(const Pistache::Rest::Request& request) {
     auto resources = request.query().get("resources").transform(url_decode);
     auto limit = request.query().get("limit").transform(url_decode);
     auto offset = request.query().get("offset").transform(url_decode);
+    auto from = request.query().get("from").transform(url_decode);
+    auto to = request.query().get("to").transform(url_decode);
+    auto since = request.query().get("since").transform(url_decode);
+    auto severity_min = request.query().get("severity_min").transform(url_decode);
+    auto after = request.query().get("after").transform(url_decode);
 
     query_parameters params{};
     if(attributes) {
@@ -146,6 +180,25 @@ query_parameters parse_parameters(const Pistache::Rest::Request& request) {
             params.offset = oi;
         }
     }
+    if(from) {
+        params.from = parse_timestamp(*from);
+    }
+    if(to) {
+        params.to = parse_timestamp(*to);
+    }
+    if(since) {
+        unsigned int si{};
+        auto [end, ec] = std::from_chars(since->data(), since->data() + since->size(), si);
+        if(ec == std::errc{} && end == since->data() + since->size()) {
+            params.since = si;
+        }
+    }
+    if(severity_min) {
+        params.severity_min = parse_severity(*severity_min);
+    }
+    if(after && !after->empty()) {
+        params.after = common::log_cursor::decode(*after);
+    }
     return params;
 }
 std::expected<void, std::string> validate_parameters(const query_parameters& params, bool needs_attributes, bool streaming) {
@@ -157,11 +210,33 @@ std::expected<void, std::string> validate_parameters(const query_parameters& par
     if(params.limit > limit) {
         return std::unexpected(std::format("maximum query limit of {} exceeded", limit));
     }
+    if(params.from && params.to && *params.from > *params.to) {
+        return std::unexpected("from must not be after to");
+    }
 
     return std::expected<void, std::string>{};
 }
 std::expected<query_parameters, std::string> validate_parameters(const Pistache::Rest::Request& request, bool needs_attributes, bool streaming) {
     auto params = parse_parameters(request);
+    // parse_parameters leaves out values it cannot parse, so tell them apart from values which were not given
+    auto given = [&](const std::string& name) {
+        return !request.query().get(name).value_or("").empty();
+    };
+    if(!params.from && given("from")) {
+        return std::unexpected("invalid timestamp given for from");
+    }
+    if(!params.to && given("to")) {
+        return std::unexpected("invalid timestamp given for to");
+    }
+    if(!params.since && given("since")) {
+        return std::unexpected("invalid number of seconds given for since");
+    }
+    if(!params.severity_min && given("severity_min")) {
+        return std::unexpected("invalid severity given for severity_min");
+    }
+    if(!params.after && given("after")) {
+        return std::unexpected("invalid cursor given for after");
+    }
     auto e = validate_parameters(params, needs_attributes, streaming);
     return e.transform([&](){
         return std::move(params);
@@ -206,43 +281,102 @@ std::string build_query(pqxx::transaction_base& txn, const query_parameters& par
     if(!params.resources.empty()) {
         query += " AND " + build_resource_filter(params.resources);
     }
-    query += " ORDER BY timestamp DESC";
+    if(params.from) {
+        query += std::format(" AND timestamp >= to_timestamp({})", *params.from);
+    }
+    if(params.to) {
+        query += std::format(" AND timestamp <= to_timestamp({})", *params.to);
+    }
+    if(params.since) {
+        query += std::format(" AND timestamp >= now() - interval '{} seconds'", *params.since);
+    }
+    if(params.severity_min) {
+        query += std::format(" AND severity >= '{}'", common::log_severity_names[std::to_underlying(*params.severity_min)]);
+    }
+    if(params.after) {
+        // the plain bound lets the timestamp index and partition pruning narrow the scan, the row comparison finds the exact position
+        std::string timestamp = std::format("to_timestamp({} / 1000000.0)", params.after->timestamp_us);
+        query += std::format(" AND timestamp <= {0} AND (timestamp, resource, scope) < ({0}, {1}, '{2}')",
+            timestamp, params.after->resource, txn.esc(params.after->scope));
+    }
+    query += " ORDER BY timestamp DESC, resource DESC, scope DESC";
     query += " LIMIT " + std::to_string(params.limit);
     query += " OFFSET " + std::to_string(params.offset);
     return query;
 }
 
-std::vector<common::log_entry> get_logs(pqxx::transaction_base& txn, const query_parameters& params) {
-    std::string query = build_query(txn, params);
+// Pages are queried with the prepared query_logs statements, so PostgreSQL can reuse their plans.
+// Larger exports are streamed with COPY, which cannot run prepared statements, but there planning hardly matters.
+bool use_prepared_query(const query_parameters& params) {
+    return params.limit <= max_query_limit;
+}
+
+pqxx::result query_logs(pqxx::transaction_base& txn, const query_parameters& params, bool force_all_attributes = false) {
+    std::optional<double> from = params.from;
+    if(params.since) {
+        double now = std::chrono::duration<double>(std::chrono::system_clock::now().time_since_epoch()).count();
+        from = std::max(from.value_or(-INFINITY), now - *params.since);
+    }
+    std::optional<std::vector<std::string>> attributes;
+    if(!force_all_attributes && std::holds_alternative<std::vector<std::string>>(*params.attributes)) {
+        attributes = std::get<std::vector<std::string>>(*params.attributes);
+    }
+    std::optional<std::int64_t> after_timestamp;
+    std::optional<unsigned int> after_resource;
+    std::optional<std::string> after_scope;
+    if(params.after) {
+        after_timestamp = params.after->timestamp_us;
+        after_resource = params.after->resource;
+        after_scope = params.after->scope;
+    }
+
+    std::string statement = "query_logs";
+    pqxx::params values{txn, from, params.to, params.severity_min, after_timestamp, after_resource, after_scope,
+        attributes, params.limit, params.offset};
+    if(!params.scopes.empty()) {
+        statement += "_by_scope";
+        values.append(params.scopes);
+    }
+    if(!params.resources.empty()) {
+        statement += "_by_resource";
+        values.append(params.resources);
+    }
+    return txn.exec(pqxx::prepped{statement}, values);
+}
+
+common::log_entry to_log_entry(const pqxx::row& row) {
+    common::log_entry log{
+        row["resource"].as<unsigned int>(),
+        row["unix_time"].as<double>(),
+        row["scope"].as<std::string>(),
+        row["severity"].as<common::log_severity>()
+    };
+    log.body = row["body"].as<std::optional<glz::generic>>().value_or(glz::generic::null_t{});
+    log.attributes = row["attributes"].as<glz::generic>();
+    return log;
+}
 
-    auto result = txn.exec(query);
+std::vector<common::log_entry> get_logs(pqxx::transaction_base& txn, const query_parameters& params) {
+    auto result = query_logs(txn, params);
     std::vector<common::log_entry> logs;
     logs.reserve(result.size());
     for(const auto& row : result) {
-        auto& l = logs.emplace_back(
-            row["resource"].as<unsigned int>(),
-            row["unix_time"].as<double>(),
-            row["scope"].as<std::string>(),
-            row["severity"].as<common::log_severity>()
-        );
-        l.body = row["body"].as<std::optional<glz::generic>>().value_or(glz::generic::null_t{});
-        unsigned int i=row.column_number("body")+1;
-        if(std::holds_alternative<query_parameters::all_attributes>(*params.attributes)) {
-            l.attributes = row["attributes"].as<glz::generic>();
-        } else {
-            for(const auto& attr : std::get<std::vector<std::string>>(*params.attributes)) {
-                auto json = row[i].as<std::optional<glz::generic>>();
-                if(json) {
-                    l.attributes[attr] = std::move(*json);
-                }
-                i++;
-            }
-        }
+        logs.push_back(to_log_entry(row));
     }
     return logs;
 }
 
+void stream_prepared_logs(pqxx::transaction_base& txn, const query_parameters& params, bool force_all_attributes, std::invocable<const common::log_entry&, unsigned int> auto&& consumer) {
+    unsigned int row_index = 0;
+    for(const auto& row : query_logs(txn, params, force_all_attributes)) {
+        consumer(to_log_entry(row), row_index++);
+    }
+}
+
 void stream_logs_all_attributes(pqxx::transaction_base& txn, const query_parameters& params, std::invocable<const common::log_entry&, unsigned int> auto&& consumer) {
+    if(use_prepared_query(params)) {
+        return stream_prepared_logs(txn, params, true, std::move(consumer));
+    }
     std::string query = build_query(txn, params, true);
     unsigned int row_index = 0;
     for(const auto& [resource, timestamp, scope, severity, body, attributes] :
@@ -325,7 +459,9 @@ namespace detail {
 }
 
 void stream_logs(pqxx::transaction_base& txn, const query_parameters& params, std::invocable<const common::log_entry&, unsigned int> auto&& consumer) {
-    if(std::holds_alternative<query_parameters::all_attributes>(*params.attributes)) {
+    if(use_prepared_query(params)) {
+        return stream_prepared_logs(txn, params, false, std::move(consumer));
+    } else if(std::holds_alternative<query_parameters::all_attributes>(*params.attributes)) {
         return stream_logs_all_attributes(txn, params, std::move(consumer));
     } else {
         return detail::stream_logs_N<0>(txn, params, std::move(consumer));
@@ -344,6 +480,26 @@ std::expected<void, std::string> check_cleanup_rule(const common::cleanup_rule&
     }
     return {};
 }
+std::expected<void, std::string> check_ingest_rule(const common::ingest_rule& rule) {
+    if(rule.name.empty()) {
+        return std::unexpected{"Field \"name\" cannot be empty"};
+    }
+    if(!(rule.sample_rate >= 0.0 && rule.sample_rate <= 1.0)) {
+        return std::unexpected{"Field \"sample_rate\" must be between 0 and 1"};
+    }
+    if(rule.action == common::ingest_action::TRANSFORM && rule.transform_actions.empty()) {
+        return std::unexpected{"Field \"transform_actions\" cannot be empty for a TRANSFORM rule"};
+    }
+    for(const auto& action : rule.transform_actions) {
+        if(action.attribute.empty()) {
+            return std::unexpected{"Field \"attribute\" of a transform action cannot be empty"};
+        }
+    }
+    if(auto res = common::compile_transform_actions(rule.transform_actions); !res) {
+        return std::unexpected{res.error()};
+    }
+    return {};
+}
 std::expected<void, std::string> check_alert_rule(const common::alert_rule& rule) {
     if(rule.name.empty()) {
         return std::unexpected{"Field \"name\" cannot be empty"};
@@ -363,6 +519,11 @@ void Server::setup_api_routes() {
         response.send(Pistache::Http::Code::Ok, common::project_version.data(), common::project_version.size());
         return Pistache::Rest::Route::Result::Ok;
     });
+    router.get("/api/v1/stats/queue", [this](const Pistache::Rest::Request& request, Pistache::Http::ResponseWriter response) {
+        bool accepts_beve = accepts(request, mime::application_beve);
+        send_response(response, accepts_beve, db.queue_stats());
+        return Pistache::Rest::Route::Result::Ok;
+    });
     router.get("/api/v1/settings", [this](const Pistache::Rest::Request& request, Pistache::Http::ResponseWriter response) {
         bool accepts_beve = accepts(request, mime::application_beve);
         send_response(response, accepts_beve, settings);
@@ -377,7 +538,7 @@ void Server::setup_api_routes() {
             response.send(Pistache::Http::Code::Bad_Request, params.error());
             return Pistache::Rest::Route::Result::Ok;
         }
-        db.queue_work([this, accepts_beve, streaming, response = std::move(response), params = std::move(*params)](pqxx::connection& conn) mutable {
+        db.queue_work(database::work_class::interactive, [this, accepts_beve, streaming, response = std::move(response), params = std::move(*params)](pqxx::connection& conn) mutable {
             pqxx::nontransaction txn{conn};
             try {
                 if(streaming) {
@@ -405,26 +566,22 @@ void Server::setup_api_routes() {
             return Pistache::Rest::Route::Result::Ok;
         }
         auto stencil = request.query().get("stencil").transform(url_decode).value_or("");
-        db.queue_work([this, response = std::move(response), params = std::move(*params), stencil = std::move(stencil)](pqxx::connection& conn) mutable {
+        db.queue_work(database::work_class::interactive, [this, response = std::move(response), params = std::move(*params), stencil = std::move(stencil)](pqxx::connection& conn) mutable {
             pqxx::nontransaction txn{conn};
             try {
-                auto result = txn.exec(pqxx::prepped{"get_resources"});
-                std::unordered_map<unsigned int, common::log_resource> resources;
-                for(const auto& row : result) {
-                    unsigned int id = row["id"].as<unsigned int>();
-                    unsigned int count = row["count"].as<unsigned int>();
-                    common::log_resource& r = resources[id];
-                    r.id = id;
-                    r.attributes = row["attributes"].as<glz::generic>();
-                    r.created_at = row["created_at"].as<double>();
-                }
+                std::unordered_map<unsigned int, common::log_resource> resources = db.resources().snapshot();
+                auto compiled = common::compiled_stencil::compile(stencil);
 
                 auto stream = response.stream(Pistache::Http::Code::Ok);
+                std::string line;
                 stream_logs_all_attributes(txn, params, [&](const common::log_entry& entry, unsigned int row_index) {
                     auto obj = common::log_entry_stencil_object::create(entry, resources);
-                    std::string line = *common::stencil(stencil, obj)
-                        .or_else([](auto err) -> std::expected<std::string, std::string> { return std::format("Stencil invalid: \"{}\"", err); })
-                        +"\n";
+                    line.clear();
+                    auto result = compiled.and_then([&](const common::compiled_stencil& c) { return c.render_to(line, obj); });
+                    if(!result) {
+                        line = std::format("Stencil invalid: \"{}\"", result.error());
+                    }
+                    line.push_back('\n');
                     stream.write(line.data(), line.size());
                 });
                 stream.ends();
@@ -437,7 +594,7 @@ void Server::setup_api_routes() {
     });
     router.get("/api/v1/logs/attributes", [this](const Pistache::Rest::Request& request, Pistache::Http::ResponseWriter response) {
         bool accepts_beve = accepts(request, mime::application_beve);
-        db.queue_work([this, accepts_beve, response = std::move(response)](pqxx::connection& conn) mutable {
+        db.queue_work(database::work_class::interactive, [this, accepts_beve, response = std::move(response)](pqxx::connection& conn) mutable {
             pqxx::nontransaction txn{conn};
             auto result = txn.exec(pqxx::prepped{"get_attributes"});
             common::logs_attributes_response res;
@@ -452,7 +609,7 @@ void Server::setup_api_routes() {
     });
     router.get("/api/v1/logs/scopes", [this](const Pistache::Rest::Request& request, Pistache::Http::ResponseWriter response) {
         bool accepts_beve = accepts(request, mime::application_beve);
-        db.queue_work([this, accepts_beve, response = std::move(response)](pqxx::connection& conn) mutable {
+        db.queue_work(database::work_class::interactive, [this, accepts_beve, response = std::move(response)](pqxx::connection& conn) mutable {
             pqxx::nontransaction txn{conn};
             auto result = txn.exec(pqxx::prepped{"get_scopes"});
             common::logs_scopes_response res{};
@@ -468,18 +625,16 @@ void Server::setup_api_routes() {
     });
     router.get("/api/v1/logs/resources", [this](const Pistache::Rest::Request& request, Pistache::Http::ResponseWriter response) {
         bool accepts_beve = accepts(request, mime::application_beve);
-        db.queue_work([this, accepts_beve, response = std::move(response)](pqxx::connection& conn) mutable {
+        db.queue_work(database::work_class::interactive, [this, accepts_beve, response = std::move(response)](pqxx::connection& conn) mutable {
             pqxx::nontransaction txn{conn};
-            auto result = txn.exec(pqxx::prepped{"get_resources"});
+            auto result = txn.exec(pqxx::prepped{"get_resource_counts"});
             common::logs_resources_response res;
             for(const auto& row : result) {
-                unsigned int id = row["id"].as<unsigned int>();
+                unsigned int id = row["resource"].as<unsigned int>();
                 unsigned int count = row["count"].as<unsigned int>();
-                common::log_resource r;
-                r.id = id;
-                r.attributes = row["attributes"].as<glz::generic>();
-                r.created_at = row["created_at"].as<double>();
-                res.resources[id] = {r, count};
+                if(auto r = db.resources().get(id)) {
+                    res.resources[id] = {*r, count};
+                }
             }
 
             send_response(response, accepts_beve, res);
@@ -488,7 +643,7 @@ void Server::setup_api_routes() {
     });
     router.get("/api/v1/settings/cleanup_rules", [this](const Pistache::Rest::Request& request, Pistache::Http::ResponseWriter response) {
         bool accepts_beve = accepts(request, mime::application_beve);
-        db.queue_work([this, accepts_beve, response = std::move(response)](pqxx::connection& conn) mutable {
+        db.queue_work(database::work_class::interactive, [this, accepts_beve, response = std::move(response)](pqxx::connection& conn) mutable {
             pqxx::nontransaction txn{conn};
 
             common::cleanup_rules_response res{db.get_cleanup_rules(txn)};
@@ -527,7 +682,7 @@ void Server::setup_api_routes() {
             }
         }
 
-        db.queue_work([this, accepts_beve, id, rule = std::move(*rule), response = std::move(response)](pqxx::connection& conn) mutable {
+        db.queue_work(database::work_class::interactive, [this, accepts_beve, id, rule = std::move(*rule), response = std::move(response)](pqxx::connection& conn) mutable {
             pqxx::work txn{conn};
 
             std::vector<unsigned int> filter_resources{rule.filters.resources.values.begin(), rule.filters.resources.values.end()};
@@ -565,6 +720,7 @@ void Server::setup_api_routes() {
                         }
                     );
                 }
+                txn.notify("cleanup_rules");
                 txn.commit();
 
                 if(cleanup_rule.empty()) {
@@ -606,7 +762,7 @@ void Server::setup_api_routes() {
     });
     router.del("/api/v1/settings/cleanup_rules/:id", [this](const Pistache::Rest::Request& request, Pistache::Http::ResponseWriter response) {
         auto id = request.param(":id").as<unsigned int>();
-        db.queue_work([this, id, response = std::move(response)](pqxx::connection& conn) mutable {
+        db.queue_work(database::work_class::interactive, [this, id, response = std::move(response)](pqxx::connection& conn) mutable {
             pqxx::work txn{conn};
             try {
                 auto result = txn.exec(pqxx::prepped{"delete_cleanup_rule"}, pqxx::params{id});
@@ -614,6 +770,137 @@ void Server::setup_api_routes() {
                     response.send(Pistache::Http::Code::Not_Found, std::format("Cleanup rule with id {} not found", id));
                     return;
                 }
+                txn.notify("cleanup_rules");
+                txn.commit();
+                response.send(Pistache::Http::Code::No_Content);
+            } catch(const std::exception& e) {
+                response.send(Pistache::Http::Code::Internal_Server_Error, e.what());
+            }
+        });
+        return Pistache::Rest::Route::Result::Ok;
+    });
+
+    router.get("/api/v1/settings/ingest_rules", [this](const Pistache::Rest::Request& request, Pistache::Http::ResponseWriter response) {
+        bool accepts_beve = accepts(request, mime::application_beve);
+        db.queue_work(database::work_class::interactive, [this, accepts_beve, response = std::move(response)](pqxx::connection& conn) mutable {
+            pqxx::nontransaction txn{conn};
+
+            common::ingest_rules_response res{db.get_ingest_rules(txn)};
+            send_response(response, accepts_beve, res);
+        });
+        return Pistache::Rest::Route::Result::Ok;
+    });
+    auto create_or_update_ingest_rule = [this]<bool update>(const Pistache::Rest::Request& request, Pistache::Http::ResponseWriter response) {
+        bool accepts_beve = accepts(request, mime::application_beve);
+
+        std::expected<common::ingest_rule, glz::error_ctx> rule;
+        if(isContentType(request, mime::application_json)) {
+            rule = glz::read<common::json_opts, common::ingest_rule>(request.body());
+        } else if(isContentType(request, mime::application_beve)) {
+            rule = glz::read<common::beve_opts, common::ingest_rule>(request.body());
+        } else {
+            response.send(Pistache::Http::Code::Unsupported_Media_Type, "Unsupported media type");
+            return Pistache::Rest::Route::Result::Ok;
+        }
+        if(!rule) {
+            response.send(Pistache::Http::Code::Bad_Request, std::format("Failed to parse request body: {}", glz::format_error(rule.error(), request.body())));
+            return Pistache::Rest::Route::Result::Ok;
+        }
+
+        if(auto res = check_ingest_rule(*rule); !res) {
+            response.send(Pistache::Http::Code::Bad_Request, std::format("Invalid request body: {}", res.error()));
+            return Pistache::Rest::Route::Result::Ok;
+        }
+
+        unsigned int id = 0;
+        if constexpr (update) {
+            id = request.param(":id").as<unsigned int>();
+            if(id != rule->id) {
+                response.send(Pistache::Http::Code::Bad_Request, "ID in URL and body do not match");
+                return Pistache::Rest::Route::Result::Ok;
+            }
+        }
+
+        db.queue_work(database::work_class::interactive, [this, accepts_beve, id, rule = std::move(*rule), response = std::move(response)](pqxx::connection& conn) mutable {
+            pqxx::work txn{conn};
+
+            std::vector<unsigned int> filter_resources{rule.filters.resources.values.begin(), rule.filters.resources.values.end()};
+            std::vector<std::string> filter_scopes{rule.filters.scopes.values.begin(), rule.filters.scopes.values.end()};
+            std::vector<common::log_severity> filter_severities{rule.filters.severities.values.begin(), rule.filters.severities.values.end()};
+            std::vector<std::string> filter_attributes{rule.filters.attributes.values.begin(), rule.filters.attributes.values.end()};
+            std::string transform_actions = glz::write_json(rule.transform_actions).value_or("[]");
+
+            try {
+                pqxx::result ingest_rule;
+                if constexpr (update) {
+                    ingest_rule = txn.exec(pqxx::prepped{"update_ingest_rule"},
+                        pqxx::params{txn,
+                            rule.name, rule.description, rule.enabled,
+                            rule.action, rule.sample_rate, transform_actions,
+                            filter_resources, rule.filters.resources.type,
+                            filter_scopes, rule.filters.scopes.type,
+                            filter_severities, rule.filters.severities.type,
+                            filter_attributes, rule.filters.attributes.type,
+                            rule.filters.attribute_values.values, rule.filters.attribute_values.type,
+                            id
+                        }
+                    );
+                } else {
+                    ingest_rule = txn.exec(pqxx::prepped{"insert_ingest_rule"},
+                        pqxx::params{txn,
+                            rule.name, rule.description, rule.enabled,
+                            rule.action, rule.sample_rate, transform_actions,
+                            filter_resources, rule.filters.resources.type,
+                            filter_scopes, rule.filters.scopes.type,
+                            filter_severities, rule.filters.severities.type,
+                            filter_attributes, rule.filters.attributes.type,
+                            rule.filters.attribute_values.values, rule.filters.attribute_values.type,
+                        }
+                    );
+                }
+                txn.notify("ingest_rules");
+                txn.commit();
+
+                if(ingest_rule.empty()) {
+                    response.send(Pistache::Http::Code::Internal_Server_Error, "Failed to insert/update ingest rule");
+                    return;
+                }
+
+                auto row = ingest_rule[0];
+                rule.id = row["id"].as<unsigned int>();
+                rule.created_at = std::chrono::sys_seconds{std::chrono::duration_cast<std::chrono::seconds>(
+                    std::chrono::duration<double>{row["created_at_s"].as<double>()})};
+                rule.updated_at = std::chrono::sys_seconds{std::chrono::duration_cast<std::chrono::seconds>(
+                    std::chrono::duration<double>{row["updated_at_s"].as<double>()})};
+
+                send_response(response, accepts_beve, rule);
+            } catch(const pqxx::unique_violation& e) {
+                response.send(Pistache::Http::Code::Conflict, std::format("Ingest rule with name \"{}\" already exists", rule.name));
+                return;
+            } catch(const std::exception& e) {
+                response.send(Pistache::Http::Code::Internal_Server_Error, e.what());
+                return;
+            }
+        });
+        return Pistache::Rest::Route::Result::Ok;
+    };
+    router.put("/api/v1/settings/ingest_rules", [create_or_update_ingest_rule](const Pistache::Rest::Request& request, Pistache::Http::ResponseWriter response) {
+        return create_or_update_ingest_rule.template operator()<false>(request, std::move(response));
+    });
+    router.patch("/api/v1/settings/ingest_rules/:id", [create_or_update_ingest_rule](const Pistache::Rest::Request& request, Pistache::Http::ResponseWriter response) {
+        return create_or_update_ingest_rule.template operator()<true>(request, std::move(response));
+    });
+    router.del("/api/v1/settings/ingest_rules/:id", [this](const Pistache::Rest::Request& request, Pistache::Http::ResponseWriter response) {
+        auto id = request.param(":id").as<unsigned int>();
+        db.queue_work(database::work_class::interactive, [this, id, response = std::move(response)](pqxx::connection& conn) mutable {
+            pqxx::work txn{conn};
+            try {
+                auto result = txn.exec(pqxx::prepped{"delete_ingest_rule"}, pqxx::params{id});
+                if(result.affected_rows() == 0) {
+                    response.send(Pistache::Http::Code::Not_Found, std::format("Ingest rule with id {} not found", id));
+                    return;
+                }
+                txn.notify("ingest_rules");
                 txn.commit();
                 response.send(Pistache::Http::Code::No_Content);
             } catch(const std::exception& e) {
@@ -626,7 +913,7 @@ void Server::setup_api_routes() {
 
     router.get("/api/v1/settings/alert_rules", [this](const Pistache::Rest::Request& request, Pistache::Http::ResponseWriter response) {
         bool accepts_beve = accepts(request, mime::application_beve);
-        db.queue_work([this, accepts_beve, response = std::move(response)](pqxx::connection& conn) mutable {
+        db.queue_work(database::work_class::interactive, [this, accepts_beve, response = std::move(response)](pqxx::connection& conn) mutable {
             pqxx::nontransaction txn{conn};
 
             common::alert_rules_response res{db.get_alert_rules(txn)};
@@ -665,7 +952,7 @@ void Server::setup_api_routes() {
             }
         }
 
-        db.queue_work([this, accepts_beve, id, rule = std::move(*rule), response = std::move(response)](pqxx::connection& conn) mutable {
+        db.queue_work(database::work_class::interactive, [this, accepts_beve, id, rule = std::move(*rule), response = std::move(response)](pqxx::connection& conn) mutable {
             pqxx::work txn{conn};
 
             std::vector<unsigned int> filter_resources{rule.filters.resources.values.begin(), rule.filters.resources.values.end()};
@@ -747,7 +1034,7 @@ void Server::setup_api_routes() {
     });
     router.del("/api/v1/settings/alert_rules/:id", [this](const Pistache::Rest::Request& request, Pistache::Http::ResponseWriter response) {
         auto id = request.param(":id").as<unsigned int>();
-        db.queue_work([this, id, response = std::move(response)](pqxx::connection& conn) mutable {
+        db.queue_work(database::work_class::interactive, [this, id, response = std::move(response)](pqxx::connection& conn) mutable {
             pqxx::work txn{conn};
             try {
                 auto result = txn.exec(pqxx::prepped{"delete_alert_rule"}, pqxx::params{id});
@@ -4,7 +4,9 @@ module;
 export module common;
 
 export import :glaze;
+export import :ingest_rules;
 export import :mmdb;
+export import :rule_matcher;
 export import :stencil_functions;
 export import :stencil;
 export import :structs;
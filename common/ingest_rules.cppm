@@ -0,0 +1,106 @@
+module;
+#include <bit>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+export module common:ingest_rules;
+
+import glaze;
+import :rule_matcher;
+import :stencil;
+import :structs;
+
+namespace common {
+
+export enum class ingest_result {
+    keep,
+    transformed, // the attributes changed, so they have to be written from the log entry
+    drop
+};
+
+// The ingest rules, their compiled transform actions and a matcher for them.
+// Replaced as a whole when the rules change, so ingest never waits for a reload.
+export struct ingest_rule_set {
+    // Receives problems with a rule, like transform actions which do not compile or stencils which fail to render.
+    using warning_handler = std::function<void(const ingest_rule&, std::string_view)>;
+
+    std::map<unsigned int, ingest_rule> rules;
+    std::map<unsigned int, std::vector<compiled_transform_action>> transforms;
+    rule_matcher<ingest_rule> matcher;
+
+    ingest_rule_set() = default;
+    // Rules whose transform actions do not compile are disabled.
+    ingest_rule_set(std::map<unsigned int, ingest_rule>&& r, const warning_handler& warn) : rules(std::move(r)) {
+        for(auto& [id, rule] : rules) {
+            if(!rule.enabled || rule.action != ingest_action::TRANSFORM) {
+                continue;
+            }
+            if(auto compiled = compile_transform_actions(rule.transform_actions); compiled) {
+                transforms.emplace(id, std::move(*compiled));
+            } else {
+                warn(rule, compiled.error());
+                rule.enabled = false;
+            }
+        }
+        matcher = rule_matcher<ingest_rule>(rules);
+    }
+    ingest_rule_set(const ingest_rule_set&) = delete;
+    ingest_rule_set& operator=(const ingest_rule_set&) = delete;
+
+    // Applies the matching rules in order of their ids, until one of them drops the log.
+    // Attribute filters of later rules see the attributes as transformed by the earlier ones.
+    ingest_result apply(log_entry& log, const warning_handler& warn) const {
+        ingest_result result = ingest_result::keep;
+        matcher.for_each_match(log, [&](const ingest_rule& rule) {
+            if(result == ingest_result::drop) {
+                return;
+            }
+            switch(rule.action) {
+                case ingest_action::DROP:
+                    result = ingest_result::drop;
+                    break;
+                case ingest_action::SAMPLE:
+                    if(!sample(rule, log)) {
+                        result = ingest_result::drop;
+                    }
+                    break;
+                case ingest_action::TRANSFORM:
+                    if(apply_transform_actions(transforms.at(rule.id), log, [&](const compiled_transform_action&, std::string_view error) {
+                        warn(rule, error);
+                    })) {
+                        result = ingest_result::transformed;
+                    }
+                    break;
+            }
+        });
+        return result;
+    }
+
+    private:
+        // Decides by a hash of the rule and the log instead of at random, so replaying a spooled request keeps the same logs.
+        static bool sample(const ingest_rule& rule, const log_entry& log) {
+            std::uint64_t hash = 0xcbf29ce484222325; // FNV-1a
+            auto mix = [&](std::uint64_t value) {
+                for(int i = 0; i < 8; i++, value >>= 8) {
+                    hash = (hash ^ (value & 0xff)) * 0x100000001b3;
+                }
+            };
+            mix(rule.id);
+            mix(log.resource);
+            mix(std::bit_cast<std::uint64_t>(log.timestamp));
+            for(unsigned char c : log.scope) {
+                hash = (hash ^ c) * 0x100000001b3;
+            }
+            // splitmix64 finalizer, so similar logs do not end up with similar hashes
+            hash = (hash ^ (hash >> 30)) * 0xbf58476d1ce4e5b9;
+            hash = (hash ^ (hash >> 27)) * 0x94d049bb133111eb;
+            hash ^= hash >> 31;
+            return static_cast<double>(hash >> 11) * 0x1.0p-53 < rule.sample_rate;
+        }
+};
+
+}
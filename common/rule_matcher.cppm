@@ -0,0 +1,148 @@
+module;
+#include <array>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+
+export module common:rule_matcher;
+
+import :structs;
+
+export namespace common {
+    // Finds the rules whose filters match a log without evaluating every rule.
+    // Resource, scope and severity filters are turned into per-value bitsets of accepting rules, so a log only
+    // has its attribute filters checked against the rules which passed those already.
+    // The matcher refers to the rules, so they must outlive it.
+    template<typename Rule>
+    class rule_matcher {
+        public:
+            rule_matcher() = default;
+            explicit rule_matcher(const std::map<unsigned int, Rule>& all_rules) {
+                for(const auto& [_, rule] : all_rules) {
+                    if(rule.enabled) {
+                        rules.push_back(&rule);
+                    }
+                }
+                words = (rules.size() + 63) / 64;
+                resources.resize(words);
+                scopes.resize(words);
+                for(auto& bits : severities) {
+                    bits.assign(words, 0);
+                }
+                unknown_severity.assign(words, 0);
+
+                for(std::size_t i = 0; i < rules.size(); i++) {
+                    const auto& filters = rules[i]->filters;
+                    resources.add(i, filters.resources);
+                    scopes.add(i, filters.scopes);
+
+                    bool include = filters.severities.type == filter_type::INCLUDE;
+                    for(std::size_t s = 0; s < severities.size(); s++) {
+                        if(filters.severities.values.contains(static_cast<log_severity>(s)) == include) {
+                            set(severities[s], i);
+                        }
+                    }
+                    if(!include) {
+                        set(unknown_severity, i);
+                    }
+                }
+            }
+
+            bool empty() const {
+                return rules.empty();
+            }
+            std::size_t size() const {
+                return rules.size();
+            }
+
+            // Calls f for every enabled rule matching the log, in order of their ids.
+            template<typename F>
+            void for_each_match(const log_entry& entry, F&& f) const {
+                if(rules.empty()) {
+                    return;
+                }
+
+                thread_local std::vector<std::uint64_t> candidates;
+                auto severity = static_cast<std::size_t>(entry.severity);
+                candidates = severity < severities.size() ? severities[severity] : unknown_severity;
+                resources.restrict(candidates, entry.resource);
+                scopes.restrict(candidates, std::string_view{entry.scope});
+
+                for(std::size_t w = 0; w < words; w++) {
+                    for(std::uint64_t word = candidates[w]; word != 0; word &= word - 1) {
+                        const Rule& rule = *rules[w * 64 + std::countr_zero(word)];
+                        if(rule.filters.match_attributes(entry)) {
+                            std::invoke(f, rule);
+                        }
+                    }
+                }
+            }
+        private:
+            using bitset = std::vector<std::uint64_t>;
+
+            static void set(bitset& bits, std::size_t i) {
+                bits[i / 64] |= std::uint64_t{1} << (i % 64);
+            }
+
+            struct string_hash {
+                using is_transparent = void;
+                std::size_t operator()(std::string_view sv) const {
+                    return std::hash<std::string_view>{}(sv);
+                }
+            };
+            template<typename Key>
+            using index_map = std::conditional_t<std::is_same_v<Key, std::string>,
+                std::unordered_map<std::string, bitset, string_hash, std::equal_to<>>,
+                std::unordered_map<Key, bitset>>;
+
+            // Rules accepting a value are the ones including it, plus the ones excluding other values only.
+            template<typename Key>
+            struct value_index {
+                bitset open; // rules with an EXCLUDE filter
+                index_map<Key> included;
+                index_map<Key> excluded;
+                std::size_t words = 0;
+
+                void resize(std::size_t w) {
+                    words = w;
+                    open.assign(w, 0);
+                }
+                template<typename Filter>
+                void add(std::size_t rule, const Filter& filter) {
+                    if(filter.type == filter_type::EXCLUDE) {
+                        set(open, rule);
+                    }
+                    auto& map = filter.type == filter_type::INCLUDE ? included : excluded;
+                    for(const auto& value : filter.values) {
+                        auto [it, _] = map.try_emplace(value, words, 0);
+                        set(it->second, rule);
+                    }
+                }
+                template<typename Lookup>
+                void restrict(bitset& candidates, const Lookup& value) const {
+                    auto inc = included.find(value);
+                    auto exc = excluded.find(value);
+                    for(std::size_t w = 0; w < words; w++) {
+                        std::uint64_t accepted = open[w];
+                        if(inc != included.end()) accepted |= inc->second[w];
+                        if(exc != excluded.end()) accepted &= ~exc->second[w];
+                        candidates[w] &= accepted;
+                    }
+                }
+            };
+
+            std::vector<const Rule*> rules;
+            std::size_t words = 0;
+            value_index<unsigned int> resources;
+            value_index<std::string> scopes;
+            std::array<bitset, log_severity_names.size()> severities;
+            bitset unknown_severity; // rules accepting severities outside of the known ones
+    };
+}
@@ -1,7 +1,14 @@
 module;
 #include <chrono>
+#include <cstddef>
 #include <expected>
 #include <format>
+#include <functional>
+#include <iterator>
+#include <limits>
+#include <memory>
+#include <optional>
+#include <span>
 #include <string_view>
 #include <string>
 #include <type_traits>
@@ -39,31 +46,38 @@ namespace common {
     concept trivially_formattable = std::formattable<T, char> && test_format<T>::value;
 
     template<typename T>
-    std::expected<std::string, std::string> format_if_possible(const T& obj) {
+    std::expected<void, std::string> format_to_if_possible(std::string& out, const T& obj) {
         if constexpr (trivially_formattable<T>) {
-            return std::format("{}", obj);
+            std::format_to(std::back_inserter(out), "{}", obj);
         } else if constexpr (std::is_pointer_v<std::decay_t<T>>) {
             using DerefT = std::remove_pointer_t<std::decay_t<T>>;
             if constexpr (trivially_formattable<DerefT>) {
-                return obj == nullptr ? "nullptr" : format_if_possible(*obj);
+                if(obj == nullptr) {
+                    out.append("nullptr");
+                } else {
+                    return format_to_if_possible(out, *obj);
+                }
             } else {
                 return std::unexpected(std::format("Cannot format type \"{}\" or \"{}\".", glz::name_v<T>, glz::name_v<DerefT>));
             }
         } else if constexpr (std::is_same_v<T, glz::generic>) {
             if(obj.is_string()) {
-                return obj.get_string();
+                out.append(obj.get_string());
             } else if(obj.is_number()) {
-                return format_if_possible(obj.get_number());
+                return format_to_if_possible(out, obj.get_number());
             } else if(obj.is_boolean()) {
-                return obj.get_boolean() ? "true" : "false";
+                out.append(obj.get_boolean() ? "true" : "false");
             } else {
-                return obj.dump().transform_error([](auto&& err) {
-                    return glz::format_error(err);
-                });
+                auto json = obj.dump();
+                if(!json) {
+                    return std::unexpected(glz::format_error(json.error()));
+                }
+                out.append(*json);
             }
         } else {
             return std::unexpected(std::format("Cannot format type \"{}\".", glz::name_v<T>));
         }
+        return {};
     }
 
     template<typename T>
@@ -126,61 +140,93 @@ namespace common {
         { t.base() } -> glz::reflectable;
     };
 
-    export template<typename T>
-    std::expected<std::string, std::string> eval_expression(T&& value, std::string_view expression, glz::reflectable auto functions, glz::reflectable auto functions_root) {
-        if(expression.empty()) {
-            return format_if_possible(value);
-        }
-        std::string_view first_expression = trim(expression);
-        std::string_view second_expression = "";
-        if(auto pos = expression.find('|'); pos != std::string::npos) {
-            first_expression = expression.substr(0, pos);
-            second_expression = expression.substr(pos + 1);
+    // A function of an expression like "from_timestamp | strftime(%Y)"
+    struct expression_stage {
+        std::string_view function;
+        std::optional<std::string_view> argument;
+    };
+    std::expected<std::vector<expression_stage>, std::string> parse_expression(std::string_view expression) {
+        std::vector<expression_stage> stages;
+        while(!expression.empty()) {
+            std::string_view stage = expression;
+            expression = {};
+            if(auto pos = stage.find('|'); pos != std::string_view::npos) {
+                expression = stage.substr(pos + 1);
+                stage = stage.substr(0, pos);
+            }
+            stage = trim(stage);
+
+            std::optional<std::string_view> argument{};
+            if(auto pos = stage.find('('); pos != std::string_view::npos) {
+                if(!stage.ends_with(')')) {
+                    return std::unexpected{"missing ')'"};
+                }
+                argument = stage.substr(pos + 1, stage.size() - pos - 2);
+                stage = stage.substr(0, pos);
+            }
+            stages.emplace_back(stage, argument);
         }
-        first_expression = trim(first_expression);
+        return stages;
+    }
 
-        std::optional<std::string_view> arg{};
-        if(auto pos = first_expression.find('('); pos != std::string::npos) {
-            if(!first_expression.ends_with(')')) {
-                return std::unexpected{"missing ')'"};
+    // A segment of a key like "resource.attributes.service?". Optional segments resolve to nothing if they are missing.
+    struct key_segment {
+        std::string_view name;
+        bool optional = false;
+    };
+    std::vector<key_segment> parse_key(std::string_view key) {
+        std::vector<key_segment> segments;
+        while(true) {
+            auto pos = key.find('.');
+            std::string_view name = key.substr(0, pos);
+            bool optional = name.ends_with('?');
+            if(optional) {
+                name.remove_suffix(1);
+            }
+            segments.emplace_back(name, optional);
+            if(pos == std::string_view::npos) {
+                return segments;
             }
-            arg = first_expression.substr(pos + 1, first_expression.size() - pos - 2);
-            first_expression = first_expression.substr(0, pos);
+            key.remove_prefix(pos + 1);
         }
+    }
+
+    // Applies the stages to the value one after another and appends the formatted result to out.
+    template<typename T, typename Functions, typename FunctionsRoot>
+    std::expected<void, std::string> append_expression(std::string& out, T&& value, std::span<const expression_stage> stages,
+        const Functions& functions, const FunctionsRoot& functions_root)
+    {
+        if(stages.empty()) {
+            return format_to_if_possible(out, value);
+        }
+        std::string_view function = stages.front().function;
+        const std::optional<std::string_view>& arg = stages.front().argument;
+        auto next = stages.subspan(1);
 
         auto keys = get_keys(functions);
         unsigned int index = 0;
-        std::expected<std::string, std::string> result = std::unexpected(std::format("cannot find function \"{}\"", first_expression));
+        std::expected<void, std::string> result{};
         bool found_one = false;
         for_each_field(functions, [&](auto&& field) { // we can safely ignore the result of this, since function is never nullptr
-            using decayed = std::decay_t<decltype(field)>;
-            if(keys[index] == first_expression) {
+            if(keys[index] == function) {
                 found_one = true;
 
                 auto eval_noarg = [&]<typename SubT>(SubT&& in){
                     if(arg) {
-                        result = std::unexpected(std::format("function \"{}\" does not take arguments", first_expression));
+                        result = std::unexpected(std::format("function \"{}\" does not take arguments", function));
                         return;
                     }
-                    auto out = field(std::forward<SubT>(in));
+                    auto x = field(std::forward<SubT>(in));
                     // TODO: implement error handling (field could return std::expected and then we could optionally unmarshal it, unless the next field takes a std::expected as well)
-                    if(second_expression.empty()) {
-                        result = format_if_possible(out);
-                    } else {
-                        result = eval_expression(out, second_expression, functions_root, functions_root);
-                    }
+                    result = append_expression(out, x, next, functions_root, functions_root);
                 };
                 auto eval_arg = [&]<typename SubT>(SubT&& in){
                     if(!arg) {
-                        result = std::unexpected(std::format("function \"{}\" requires an argument", first_expression));
+                        result = std::unexpected(std::format("function \"{}\" requires an argument", function));
                         return;
                     }
                     auto x = field(std::forward<SubT>(in), *arg);
-                    if(second_expression.empty()) {
-                        result = format_if_possible(x);
-                    } else {
-                        result = eval_expression(x, second_expression, functions_root, functions_root);
-                    }
+                    result = append_expression(out, x, next, functions_root, functions_root);
                 };
 
                 if constexpr (std::is_invocable_v<decltype(field), T&&>) {
@@ -194,7 +240,7 @@ namespace common {
                         if(value == nullptr) {
                             result = std::unexpected(std::format(
                                 "refusing dereference nullptr of type \"{}\" to \"{}\" in order to call \"{}\"",
-                                glz::name_v<std::decay_t<T>>, glz::name_v<std::decay_t<DerefT>>, first_expression
+                                glz::name_v<std::decay_t<T>>, glz::name_v<std::decay_t<DerefT>>, function
                             ));
                         } else {
                             eval_noarg.template operator()<DerefT>(std::forward<DerefT>(*value));
@@ -203,221 +249,430 @@ namespace common {
                         if(value == nullptr) {
                             result = std::unexpected(std::format(
                                 "refusing dereference nullptr of type \"{}\" to \"{}\" in order to call \"{}\"",
-                                glz::name_v<std::decay_t<T>>, glz::name_v<std::decay_t<DerefT>>, first_expression
+                                glz::name_v<std::decay_t<T>>, glz::name_v<std::decay_t<DerefT>>, function
                             ));
                         } else {
                             eval_arg.template operator()<DerefT>(std::forward<DerefT>(*value));
                         }
                     } else {
                         result = std::unexpected(std::format("cannot call function \"{}\" with argument of type \"{}\" or \"{}\"",
-                            first_expression, glz::name_v<std::decay_t<T>>, glz::name_v<std::decay_t<DerefT>>));
+                            function, glz::name_v<std::decay_t<T>>, glz::name_v<std::decay_t<DerefT>>));
                     }
                 } else {
                     result = std::unexpected(std::format("cannot call function \"{}\" with argument of type \"{}\"",
-                        first_expression, glz::name_v<std::decay_t<T>>));
+                        function, glz::name_v<std::decay_t<T>>));
                 }
             }
             index++;
         });
         if(!found_one) {
-            if constexpr (has_base_function<decltype(functions)>) {
-                return eval_expression(value, expression, functions.base(), functions_root);
-            } else if constexpr (has_base<decltype(functions)>) {
-                return eval_expression(value, expression, functions.base, functions_root);
+            if constexpr (has_base_function<Functions>) {
+                return append_expression(out, value, stages, functions.base(), functions_root);
+            } else if constexpr (has_base<Functions>) {
+                return append_expression(out, value, stages, functions.base, functions_root);
+            } else {
+                return std::unexpected(std::format("cannot find function \"{}\"", function));
             }
         }
 
         return result;
     }
 
+    export template<typename T>
+    std::expected<std::string, std::string> eval_expression(T&& value, std::string_view expression, glz::reflectable auto functions, glz::reflectable auto functions_root) {
+        auto stages = parse_expression(expression);
+        if(!stages) {
+            return std::unexpected(std::move(stages.error()));
+        }
+        std::string result{};
+        if(auto r = append_expression(result, std::forward<T>(value), *stages, functions, functions_root); !r) {
+            return std::unexpected(std::move(r.error()));
+        }
+        return result;
+    }
+
     template<typename T>
     concept has_root = requires() {
         { T::root } -> std::convertible_to<std::string_view>;
     };
 
-    export template<can_get_field T, glz::reflectable Functions = stencil_functions>
-    std::expected<std::string, std::string> get_field(const T& obj, std::string_view key,
-        const Functions& functions = stencil_functions{}, std::string_view expression = "")
+    // Resolves the key segment by segment, applies the expression to the value it resolves to and appends the result to out.
+    // Keys which are not found are looked up in the root of the object, if it has one.
+    template<can_get_field T, typename Functions>
+    std::expected<void, std::string> append_field(std::string& out, const T& obj, std::span<const key_segment> key,
+        std::span<const expression_stage> expression, const Functions& functions)
     {
-        std::string_view first_key = key;
-        std::string_view second_key = "";
-        if(auto pos = key.find('.'); pos != std::string::npos) {
-            first_key = key.substr(0, pos);
-            second_key = key.substr(pos + 1);
-        }
-        bool key_found = false;
-        std::expected<std::string, std::string> result = std::unexpected("key not found: "+std::string(first_key));
-        if(first_key.ends_with("?")) {
-            first_key = first_key.substr(0, first_key.size() - 1);
-            result = "";
-        }
-        if(first_key.empty()) {
-            if(key.empty()) {
-                return eval_expression(obj, expression, functions, functions);
+        const key_segment& first = key.front();
+        auto rest = key.subspan(1);
+        std::string_view name = first.name;
+        if(name.empty()) {
+            if(rest.empty() && !first.optional) {
+                return append_expression(out, obj, expression, functions, functions);
             }
 
             if constexpr (has_root<T>) {
-                first_key = T::root;
+                name = T::root;
             } else  {
                 return std::unexpected{std::format("\".\" given as key, but type \"{}\" does not have a root", glz::name_v<T>)};
             }
         }
 
-        auto keys = get_keys(obj);
-        unsigned int index = 0;
-        auto for_each_result = for_each_field<T>(obj, [&](auto&& field) {
+        bool key_found = false;
+        std::expected<void, std::string> result{};
+        auto eval_field = [&](auto&& field) {
             using decayed = std::decay_t<decltype(field)>;
-            if(keys[index] == first_key) {
-                key_found = true;
-                if constexpr (can_get_field<decayed>) {
-                    if(second_key.empty()) {
-                        result = eval_expression(field, expression, functions, functions);
-                    } else {
-                        result = get_field(field, second_key, functions, expression);
-                    }
+            key_found = true;
+            if constexpr (can_get_field<decayed>) {
+                if(rest.empty()) {
+                    result = append_expression(out, field, expression, functions, functions);
                 } else {
-                    result = eval_expression(field, expression, functions, functions);
+                    result = append_field(out, field, rest, expression, functions);
                 }
+            } else {
+                result = append_expression(out, field, expression, functions, functions);
             }
-            index++;
-        });
+        };
+
+        std::expected<void, std::string> for_each_result{};
+        if constexpr (std::same_as<T, glz::generic>) {
+            if(obj.is_object()) {
+                const glz::generic::object_t& o = obj.get_object();
+                if(auto it = o.find(name); it != o.end()) {
+                    eval_field(it->second);
+                }
+            }
+        } else {
+            auto keys = get_keys(obj);
+            unsigned int index = 0;
+            for_each_result = for_each_field<T>(obj, [&](auto&& field) {
+                if(keys[index++] == name) {
+                    eval_field(field);
+                }
+            });
+        }
 
         if(!for_each_result) {
-            result = std::unexpected(for_each_result.error());
-        } else if constexpr (has_root<T>) { // if we cannot iterate over the object, there is no point in looking for a root
-            if(!key_found) {
+            result = std::unexpected(std::move(for_each_result.error()));
+        } else if(!key_found) {
+            if constexpr (has_root<T>) { // if we cannot iterate over the object, there is no point in looking for a root
+                auto keys = get_keys(obj);
                 unsigned int index = 0;
                 for_each_field<T>(obj, [&](auto&& field) {
                     using decayed = std::decay_t<decltype(field)>;
-                    if(keys[index] == T::root) {
-                        result = get_field(field, key, functions, expression);
+                    if constexpr (can_get_field<decayed>) {
+                        if(keys[index] == T::root) {
+                            key_found = true;
+                            result = append_field(out, field, key, expression, functions);
+                        }
                     }
                     index++;
                 });
             }
+            if(!key_found && !first.optional) {
+                result = std::unexpected(std::format("key not found: {}", first.name));
+            }
         }
 
-        return result.transform_error([&](auto&& err) {
-            return std::string{first_key}+": "+err;
-        });
+        if(!result) {
+            return std::unexpected(std::format("{}: {}", name, result.error()));
+        }
+        return result;
+    }
+
+    export template<can_get_field T, glz::reflectable Functions = stencil_functions>
+    std::expected<std::string, std::string> get_field(const T& obj, std::string_view key,
+        const Functions& functions = stencil_functions{}, std::string_view expression = "")
+    {
+        auto stages = parse_expression(expression);
+        if(!stages) {
+            return std::unexpected(std::move(stages.error()));
+        }
+        std::string result{};
+        if(auto r = append_field(result, obj, parse_key(key), *stages, functions); !r) {
+            return std::unexpected(std::move(r.error()));
+        }
+        return result;
     }
 
     template<typename T>
     concept can_stencil = can_get_field<T>;
 
-    enum class if_end_type {
-        else_,
-        end_
-    };
-    std::optional<std::pair<std::string_view::size_type, if_end_type>> find_if_end(std::string_view stencil, std::string_view::size_type pos) {
-        int depth = 0;
-        while(pos < stencil.size()) {
-            char c = stencil[pos++];
-            if(c == '{') {
-                if(pos >= stencil.size()) {
-                    return std::nullopt;
-                }
-                auto end = stencil.find('}', pos);
-                if(end == std::string_view::npos) {
-                    return std::nullopt;
-                }
-                std::string_view key = stencil.substr(pos, end - pos);
-                if(key.starts_with("?")) {
-                    depth++;
-                } else if(key == ":?") {
-                    if(depth == 0) {
-                        return std::make_pair(end+1, if_end_type::else_);
-                    }
-                } else if(key == "/?") {
-                    if(depth == 0) {
-                        return std::make_pair(end+1, if_end_type::end_);
+    // A stencil parsed once, so it can be evaluated for many objects without scanning the template again.
+    // Literal text is unescaped, keys are split into segments, expressions into their functions and conditionals are
+    // turned into jumps while compiling. Keys and functions are still looked up by name when evaluating, because what
+    // they resolve to depends on the object (e.g. glz::generic attributes).
+    export class compiled_stencil {
+        public:
+            static std::expected<compiled_stencil, std::string> compile(std::string_view stencil) {
+                compiled_stencil result{};
+                // every character of the stencil is stored at most once, so the buffer never reallocates and views into it stay valid
+                auto buffer = std::make_shared<std::string>();
+                buffer->reserve(stencil.size());
+                result.strings = buffer;
+
+                std::vector<tag> tags;
+                bool merge_text = false; // text is never merged across tags, so jump targets always start an instruction
+                std::string_view::size_type pos = 0;
+                while(pos < stencil.size()) {
+                    char c = stencil[pos++];
+                    if(c == '{') {
+                        if(pos >= stencil.size()) {
+                            return std::unexpected{"unexpected end of stencil"};
+                        }
+                        auto end = stencil.find('}', pos);
+                        if(end == std::string_view::npos) {
+                            return std::unexpected{"missing '}'"};
+                        }
+                        std::string_view key = stencil.substr(pos, end - pos);
+                        std::string_view expression{};
+                        if(auto pos = key.find('|'); pos != std::string_view::npos) {
+                            expression = trim(key.substr(pos + 1));
+                            key = trim(key.substr(0, pos));
+                        }
+                        pos = end + 1;
+                        merge_text = false;
+
+                        if(key.starts_with("?")) {
+                            key.remove_prefix(1);
+                            tags.emplace_back(tag_type::if_, result.instructions.size());
+                            if(auto r = result.add_field(*buffer, op::condition, key, expression); !r) {
+                                return std::unexpected(std::move(r.error()));
+                            }
+                        } else if(key == ":?") {
+                            tags.emplace_back(tag_type::else_, result.instructions.size());
+                            result.instructions.emplace_back(op::skip);
+                        } else if(key == "/?") {
+                            tags.emplace_back(tag_type::end_, result.instructions.size());
+                        } else if(auto r = result.add_field(*buffer, op::field, key, expression); !r) {
+                            return std::unexpected(std::move(r.error()));
+                        }
+                    } else {
+                        if(c == '\\') {
+                            if(pos >= stencil.size()) {
+                                return std::unexpected{"unexpected end of stencil"};
+                            }
+                            c = stencil[pos++];
+                            if(c == 'n') {
+                                c = '\n';
+                            } else if(c == 't') {
+                                c = '\t';
+                            } else if(c != '{' && c != '}' && c != '\\') {
+                                return std::unexpected{"invalid escape sequence"};
+                            }
+                        }
+                        if(merge_text) {
+                            buffer->push_back(c);
+                            std::string_view& text = result.instructions.back().text;
+                            text = std::string_view{text.data(), text.size() + 1};
+                        } else {
+                            result.instructions.emplace_back(op::text, store(*buffer, std::string_view{&c, 1}));
+                            merge_text = true;
+                        }
                     }
-                    depth--;
                 }
-                pos = end + 1;
+                result.resolve_jumps(tags);
+                return result;
             }
-        }
-        return std::nullopt;
-    }
 
-    export template<can_stencil T, glz::reflectable Functions = stencil_functions>
-    std::expected<std::string, std::string> stencil(std::string_view stencil, const T& obj, const Functions& functions = stencil_functions{}) {
-        std::string result{};
-        std::string_view::size_type pos = 0;
-        while(pos < stencil.size()) {
-            char c = stencil[pos++];
-            if(c == '{') {
-                if(pos >= stencil.size()) {
-                    return std::unexpected{"unexpected end of stencil"};
+            // Appends the result to out, so a buffer can be reused for many objects. On error, out may contain partial output.
+            template<can_stencil T, glz::reflectable Functions = stencil_functions>
+            std::expected<void, std::string> render_to(std::string& out, const T& obj, const Functions& functions = stencil_functions{}) const {
+                std::size_t ip = 0;
+                while(ip < instructions.size()) {
+                    const instruction& in = instructions[ip];
+                    switch(in.type) {
+                        case op::text:
+                            out.append(in.text);
+                            ip++;
+                            break;
+                        case op::field:
+                            if(auto r = append_field(out, obj, key_of(in), expression_of(in), functions); !r) {
+                                return std::unexpected(std::move(r.error()));
+                            }
+                            ip++;
+                            break;
+                        case op::condition: {
+                            // evaluated into out like any field, and removed again once it was checked
+                            std::size_t start = out.size();
+                            if(auto r = append_field(out, obj, key_of(in), expression_of(in), functions); !r) {
+                                return std::unexpected(std::move(r.error()));
+                            }
+                            std::string_view value = std::string_view{out}.substr(start);
+                            if(value == "true") {
+                                ip++;
+                            } else if(value == "false") {
+                                if(in.target == no_target) {
+                                    return std::unexpected("Could not find else or end tag");
+                                }
+                                ip = in.target;
+                            } else {
+                                return std::unexpected(std::format("Boolean expression \"{}\" is not either \"true\" or \"false\".", value));
+                            }
+                            out.resize(start);
+                            break;
+                        }
+                        case op::skip: // reached the else branch, so the condition was true and we skip to the end
+                            if(in.target == no_target) {
+                                return std::unexpected("Could not find end tag");
+                            }
+                            ip = in.target;
+                            break;
+                    }
                 }
-                auto end = stencil.find('}', pos);
-                if(end == std::string_view::npos) {
-                    return std::unexpected{"missing '}'"};
+                return {};
+            }
+            template<can_stencil T, glz::reflectable Functions = stencil_functions>
+            std::expected<std::string, std::string> render(const T& obj, const Functions& functions = stencil_functions{}) const {
+                std::string result{};
+                if(auto r = render_to(result, obj, functions); !r) {
+                    return std::unexpected(std::move(r.error()));
                 }
-                std::string_view key = stencil.substr(pos, end - pos);
-                std::string_view expression{};
-                if(auto pos = key.find('|'); pos != std::string_view::npos) {
-                    expression = trim(key.substr(pos + 1));
-                    key = trim(key.substr(0, pos));
+                return result;
+            }
+        private:
+            enum class op {
+                text,      // appends literal text
+                field,     // appends the value of a key
+                condition, // continues if a key is "true", jumps to target if it is "false"
+                skip       // jumps to target
+            };
+            static constexpr std::size_t no_target = std::numeric_limits<std::size_t>::max(); // jumping there is an error
+
+            struct slice {
+                std::size_t begin = 0;
+                std::size_t end = 0;
+            };
+            struct instruction {
+                op type;
+                std::string_view text{}; // literal text
+                slice key{};             // into segments
+                slice expression{};      // into stages
+                std::size_t target = no_target;
+            };
+
+            enum class tag_type {
+                if_, else_, end_
+            };
+            struct tag {
+                tag_type type;
+                std::size_t instruction; // the one it compiled to, or the one following it for end tags
+            };
+
+            static std::string_view store(std::string& buffer, std::string_view str) {
+                auto offset = buffer.size();
+                buffer.append(str);
+                return std::string_view{buffer}.substr(offset, str.size());
+            }
+            std::expected<void, std::string> add_field(std::string& buffer, op type, std::string_view key, std::string_view expression) {
+                auto parsed = parse_expression(store(buffer, expression));
+                if(!parsed) {
+                    return std::unexpected(std::move(parsed.error()));
                 }
+                instruction& in = instructions.emplace_back(type);
+                in.expression = {stages.size(), stages.size() + parsed->size()};
+                stages.insert(stages.end(), parsed->begin(), parsed->end());
+
+                auto segments_of_key = parse_key(store(buffer, key));
+                in.key = {segments.size(), segments.size() + segments_of_key.size()};
+                segments.insert(segments.end(), segments_of_key.begin(), segments_of_key.end());
+                return {};
+            }
+            std::span<const key_segment> key_of(const instruction& in) const {
+                return std::span{segments}.subspan(in.key.begin, in.key.end - in.key.begin);
+            }
+            std::span<const expression_stage> expression_of(const instruction& in) const {
+                return std::span{stages}.subspan(in.expression.begin, in.expression.end - in.expression.begin);
+            }
 
-                if(key.starts_with("?")) {
-                    key.remove_prefix(1);
-                    auto field = get_field(obj, key, functions, expression);
-                    if(!field) {
-                        return std::unexpected(field.error());
-                    }
-
-                    if(*field == "true") {
-                        pos = end + 1;
-                    } else if(*field == "false") {
-                        auto if_end = find_if_end(stencil, end+1);
-                        if(!if_end) {
-                            return std::unexpected("Could not find else or end tag");
-                        }
-                        pos = if_end->first;
+            // A false condition continues after its else or end tag, a reached else tag continues after its end tag.
+            void resolve_jumps(const std::vector<tag>& tags) {
+                for(std::size_t t = 0; t < tags.size(); t++) {
+                    if(tags[t].type == tag_type::end_) {
                         continue;
-                    } else {
-                        return std::unexpected(std::format("Boolean expression \"{}\" is not either \"true\" or \"false\".", *field));
-                    }
-                } else if(key == ":?") { // if this is encountered, the boolean expression evaluated to true and we should skip to the end
-                    auto if_end = find_if_end(stencil, end+1);
-                    if(!if_end || if_end->second != if_end_type::end_) {
-                        return std::unexpected("Could not find end tag");
                     }
-                    pos = if_end->first;
-                    continue;
-                } else if(key == "/?") {
-                    pos = end + 1;
-                } else {
-                    auto field = get_field(obj, key, functions, expression);
-                    if(!field) {
-                        return std::unexpected(field.error());
+                    int depth = 0;
+                    for(std::size_t i = t + 1; i < tags.size(); i++) {
+                        if(tags[i].type == tag_type::if_) {
+                            depth++;
+                        } else if(depth > 0) {
+                            depth -= tags[i].type == tag_type::end_;
+                        } else {
+                            auto after = tags[i].type == tag_type::end_ ? tags[i].instruction : tags[i].instruction + 1;
+                            if(tags[t].type == tag_type::if_ || tags[i].type == tag_type::end_) {
+                                instructions[tags[t].instruction].target = after;
+                            }
+                            break;
+                        }
                     }
-
-                    result.append(field.value());
-                    pos = end + 1;
-                }
-            } else if(c == '\\') {
-                if(pos >= stencil.size()) {
-                    return std::unexpected{"unexpected end of stencil"};
-                }
-                c = stencil[pos++];
-                if(c == '{' || c == '}' || c == '\\') {
-                    result.push_back(c);
-                } else if(c == 'n') {
-                    result.push_back('\n');
-                } else if(c == 't') {
-                    result.push_back('\t');
-                } else {
-                    return std::unexpected{"invalid escape sequence"};
                 }
-            } else {
-                result.push_back(c);
             }
+
+            // Literal text, keys and expressions of all instructions, which the views point into. It is never modified
+            // after compiling, so copies of a compiled stencil share it.
+            std::shared_ptr<const std::string> strings;
+            std::vector<instruction> instructions;
+            std::vector<key_segment> segments;
+            std::vector<expression_stage> stages;
+    };
+
+    export template<can_stencil T, glz::reflectable Functions = stencil_functions>
+    std::expected<std::string, std::string> stencil(std::string_view stencil, const T& obj, const Functions& functions = stencil_functions{}) {
+        return compiled_stencil::compile(stencil).and_then([&](const compiled_stencil& compiled) {
+            return compiled.render(obj, functions);
+        });
+    }
+
+    // A transform action with its stencil compiled, so applying it to many logs does not parse the stencil every time.
+    export struct compiled_transform_action {
+        transform_action_type type;
+        std::string attribute;
+        std::optional<compiled_stencil> stencil; // set for SET_ATTRIBUTE
+    };
+    export std::expected<std::vector<compiled_transform_action>, std::string> compile_transform_actions(const std::vector<transform_action>& actions) {
+        std::vector<compiled_transform_action> result;
+        result.reserve(actions.size());
+        for(const auto& action : actions) {
+            auto& compiled = result.emplace_back(action.type, action.attribute);
+            if(action.type != transform_action_type::SET_ATTRIBUTE) {
+                continue;
+            }
+            if(!action.stencil) {
+                return std::unexpected(std::format("No stencil provided for attribute \"{}\"", action.attribute));
+            }
+            auto stencil = compiled_stencil::compile(*action.stencil);
+            if(!stencil) {
+                return std::unexpected(std::format("Invalid stencil for attribute \"{}\": {}", action.attribute, stencil.error()));
+            }
+            compiled.stencil = std::move(*stencil);
         }
         return result;
     }
+    // Applies the actions to the attributes of the log one after another and returns whether anything changed.
+    // A stencil which fails to render leaves its attribute alone, on_error gets the action and the error.
+    export template<typename OnError>
+    bool apply_transform_actions(std::span<const compiled_transform_action> actions, log_entry& log, OnError&& on_error) {
+        if(!log.attributes.is_object()) {
+            log.attributes = glz::generic::object_t{};
+        }
+        auto& attrs_obj = log.attributes.get_object();
+        bool changed = false;
+        for(const auto& action : actions) {
+            switch(action.type) {
+                case transform_action_type::REMOVE_ATTRIBUTE:
+                    changed |= attrs_obj.erase(action.attribute) > 0;
+                    break;
+                case transform_action_type::SET_ATTRIBUTE:
+                    if(auto value_expected = action.stencil->render(log); value_expected) {
+                        attrs_obj[action.attribute] = std::move(*value_expected);
+                        changed = true;
+                    } else {
+                        std::invoke(on_error, action, value_expected.error());
+                    }
+                    break;
+            }
+        }
+        return changed;
+    }
 
     export std::expected<std::unordered_set<std::string_view>, std::string> stencil_required_attributes(std::string_view stencil) {
         std::unordered_set<std::string_view> result{};
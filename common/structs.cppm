@@ -1,10 +1,15 @@
 module;
 #include <array>
+#include <charconv>
 #include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <format>
 #include <map>
 #include <optional>
 #include <set>
 #include <string>
+#include <string_view>
 #include <unordered_map>
 #include <utility>
 #include <vector>
@@ -93,6 +98,37 @@ export namespace common {
         }
     };
 
+    // Position in the result of a log query, which is sorted by timestamp, resource and scope (all descending).
+    // Passing the cursor of the last row of a page as "after" fetches the next page without the cost of an OFFSET.
+    struct log_cursor {
+        std::int64_t timestamp_us;
+        unsigned int resource;
+        std::string scope;
+
+        static log_cursor after(const log_entry& entry) {
+            // the timestamp is exact to the microsecond, so rounding recovers the stored value
+            return log_cursor{std::llround(entry.timestamp * 1e6), entry.resource, entry.scope};
+        }
+
+        // The encoding is opaque to clients, they should only pass it back.
+        std::string encode() const {
+            return std::format("{}.{}.{}", timestamp_us, resource, scope);
+        }
+        static std::optional<log_cursor> decode(std::string_view sv) {
+            log_cursor cursor{};
+            auto [ts_end, ts_ec] = std::from_chars(sv.data(), sv.data() + sv.size(), cursor.timestamp_us);
+            if(ts_ec != std::errc{} || ts_end == sv.data() + sv.size() || *ts_end != '.') {
+                return std::nullopt;
+            }
+            auto [res_end, res_ec] = std::from_chars(ts_end + 1, sv.data() + sv.size(), cursor.resource);
+            if(res_ec != std::errc{} || res_end == sv.data() + sv.size() || *res_end != '.') {
+                return std::nullopt;
+            }
+            cursor.scope = std::string{res_end + 1, sv.data() + sv.size()}; // the scope may contain dots itself
+            return cursor;
+        }
+    };
+
     using logs_response = std::vector<common::log_entry>;
     static_assert(serializable<logs_response>);
 
@@ -113,6 +149,14 @@ export namespace common {
     };
     static_assert(serializable<logs_resources_response>);
 
+    struct queue_stats {
+        std::size_t depth;
+        std::size_t capacity; // 0 if unlimited
+        std::uint64_t rejected;
+        std::size_t connections; // open database connections
+    };
+    static_assert(serializable<queue_stats>);
+
     enum class filter_type {
         INCLUDE, EXCLUDE
     };
@@ -120,6 +164,50 @@ export namespace common {
         "INCLUDE", "EXCLUDE"
     };
 
+    // Containment like the jsonb @> operator: objects contain objects with a subset of their keys (recursively),
+    // arrays contain arrays whose elements are each contained in any of their elements, and scalars contain equal scalars.
+    // Only at the top level, an array also contains a scalar element of it.
+    bool json_contains(const glz::generic& container, const glz::generic& contained, bool top_level = true) {
+        if(container.is_object()) {
+            if(!contained.is_object()) {
+                return false;
+            }
+            const auto& object = container.get_object();
+            for(const auto& [key, value] : contained.get_object()) {
+                auto it = object.find(key);
+                if(it == object.end() || !json_contains(it->second, value, false)) {
+                    return false;
+                }
+            }
+            return true;
+        }
+        if(container.is_array()) {
+            const auto& array = container.get_array();
+            auto contains_element = [&](const glz::generic& element) {
+                for(const auto& candidate : array) {
+                    if(json_contains(candidate, element, false)) {
+                        return true;
+                    }
+                }
+                return false;
+            };
+            if(contained.is_array()) {
+                for(const auto& element : contained.get_array()) {
+                    if(!contains_element(element)) {
+                        return false;
+                    }
+                }
+                return true;
+            }
+            return top_level && !contained.is_object() && contains_element(contained);
+        }
+        if(container.is_null()) return contained.is_null();
+        if(container.is_boolean()) return contained.is_boolean() && container.get<bool>() == contained.get<bool>();
+        if(container.is_number()) return contained.is_number() && container.get<double>() == contained.get<double>();
+        if(container.is_string()) return contained.is_string() && container.get_string() == contained.get_string();
+        return false;
+    }
+
     template<typename T>
     struct filter {
         filter_type type = filter_type::EXCLUDE;
@@ -140,6 +228,10 @@ export namespace common {
             if(scopes.type == filter_type::EXCLUDE &&  scopes.values.contains(entry.scope)) { return false; }
             if(severities.type == filter_type::INCLUDE && !severities.values.contains(entry.severity)) { return false; }
             if(severities.type == filter_type::EXCLUDE &&  severities.values.contains(entry.severity)) { return false; }
+            return match_attributes(entry);
+        }
+        // Only the attribute related filters, for callers which already checked resource, scope and severity.
+        bool match_attributes(const log_entry& entry) const {
             if(attributes.type == filter_type::INCLUDE) {
                 for(const auto& a : attributes.values) {
                     if(!entry.attributes.contains(a)) { return false; }
@@ -149,7 +241,12 @@ export namespace common {
                     if(entry.attributes.contains(a)) { return false; }
                 }
             }
-            // TODO: attribute_values filtering
+            if(!attribute_values.values.empty()) {
+                // same semantics as the "attributes @> values" used by the cleanup jobs
+                bool contained = json_contains(entry.attributes, attribute_values.values);
+                if(attribute_values.type == filter_type::INCLUDE && !contained) { return false; }
+                if(attribute_values.type == filter_type::EXCLUDE &&  contained) { return false; }
+            }
             return true;
         }
     };
@@ -196,6 +293,36 @@ export namespace common {
     };
     static_assert(serializable<cleanup_rules_response>);
 
+    enum class ingest_action {
+        DROP, SAMPLE, TRANSFORM
+    };
+    constexpr std::array ingest_action_names = {
+        "DROP", "SAMPLE", "TRANSFORM"
+    };
+
+    // Applied to matching logs before they are written to the database, in order of their ids.
+    struct ingest_rule {
+        unsigned int id;
+        std::string name;
+        std::string description;
+        bool enabled = false;
+
+        standard_filters filters;
+
+        ingest_action action = ingest_action::DROP;
+        double sample_rate = 1.0; // SAMPLE: fraction of the matching logs which are kept
+        std::vector<transform_action> transform_actions; // TRANSFORM: applied to the attributes one after another
+
+        std::chrono::sys_seconds created_at;
+        std::chrono::sys_seconds updated_at;
+    };
+    static_assert(serializable<ingest_rule>);
+
+    struct ingest_rules_response {
+        std::map<unsigned int, ingest_rule> rules;
+    };
+    static_assert(serializable<ingest_rules_response>);
+
     struct alert_rule {
         unsigned int id;
         std::string name;
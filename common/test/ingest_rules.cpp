@@ -0,0 +1,83 @@
+#include <iostream>
+#include <map>
+#include <optional>
+#include <set>
+#include <string>
+#include <string_view>
+
+import common;
+import glaze;
+
+common::ingest_rule make_rule(unsigned int id, std::string name, common::ingest_action action) {
+    common::ingest_rule rule{};
+    rule.id = id;
+    rule.name = std::move(name);
+    rule.enabled = true;
+    rule.action = action;
+    return rule;
+}
+
+int main() {
+    std::map<unsigned int, common::ingest_rule> rules;
+
+    rules[1] = make_rule(1, "set first", common::ingest_action::TRANSFORM);
+    rules[1].transform_actions = {{common::transform_action_type::SET_ATTRIBUTE, "first", "{scope}"}};
+
+    rules[2] = make_rule(2, "sample out scope \"sampled\"", common::ingest_action::SAMPLE);
+    rules[2].filters.scopes = {common::filter_type::INCLUDE, {"sampled"}};
+    rules[2].sample_rate = 0.0;
+
+    // only matches once rule 1 ran
+    rules[3] = make_rule(3, "set second after first", common::ingest_action::TRANSFORM);
+    rules[3].filters.attributes = {common::filter_type::INCLUDE, {"first"}};
+    rules[3].transform_actions = {
+        {common::transform_action_type::SET_ATTRIBUTE, "second", "{scope}"},
+        {common::transform_action_type::REMOVE_ATTRIBUTE, "removed", std::nullopt}
+    };
+
+    rules[4] = make_rule(4, "drop scope \"dropped\"", common::ingest_action::DROP);
+    rules[4].filters.scopes = {common::filter_type::INCLUDE, {"dropped"}};
+
+    rules[5] = make_rule(5, "set last", common::ingest_action::TRANSFORM);
+    rules[5].transform_actions = {{common::transform_action_type::SET_ATTRIBUTE, "last", "{scope}"}};
+
+    rules[6] = make_rule(6, "keep everything", common::ingest_action::SAMPLE);
+    rules[6].sample_rate = 1.0;
+
+    common::ingest_rule_set rule_set{std::move(rules), [](const common::ingest_rule& rule, std::string_view error) {
+        std::cout << "rule " << rule.id << " disabled: " << error << std::endl;
+    }};
+
+    auto check = [&](std::string_view scope, common::ingest_result expected_result, const std::set<std::string>& expected_attributes) {
+        common::log_entry log{};
+        log.scope = std::string{scope};
+        log.severity = common::log_severity::INFO;
+        log.attributes = glz::generic::object_t{{"removed", true}};
+
+        auto result = rule_set.apply(log, [](const common::ingest_rule& rule, std::string_view error) {
+            std::cout << "rule " << rule.id << " failed: " << error << std::endl;
+        });
+        std::set<std::string> attributes;
+        for(const auto& [key, value] : log.attributes.get_object()) {
+            attributes.insert(key);
+        }
+
+        std::cout << scope << ":";
+        for(const auto& key : attributes) {
+            std::cout << " " << key;
+        }
+        std::cout << (result == expected_result ? "" : " (unexpected result!)");
+        std::cout << (attributes == expected_attributes ? "" : " (unexpected attributes!)") << std::endl;
+        return result == expected_result && attributes == expected_attributes;
+    };
+
+    bool ok = true;
+    // every transform runs, the later ones see the attributes of the earlier ones
+    ok &= check("kept", common::ingest_result::transformed, {"first", "last", "second"});
+    // rules after the drop do not run anymore
+    ok &= check("dropped", common::ingest_result::drop, {"first", "second"});
+    // sampling drops before any later rule runs
+    ok &= check("sampled", common::ingest_result::drop, {"first", "removed"});
+
+    return ok ? 0 : 1;
+}
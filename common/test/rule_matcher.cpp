@@ -0,0 +1,119 @@
+#include <iostream>
+#include <map>
+#include <set>
+#include <string>
+#include <string_view>
+
+import common;
+import glaze;
+
+common::alert_rule make_rule(unsigned int id, std::string name) {
+    common::alert_rule rule{};
+    rule.id = id;
+    rule.name = std::move(name);
+    rule.enabled = true;
+    return rule;
+}
+
+int main() {
+    std::map<unsigned int, common::alert_rule> rules;
+
+    rules[1] = make_rule(1, "everything");
+
+    rules[2] = make_rule(2, "errors of resource 7");
+    rules[2].filters.resources = {common::filter_type::INCLUDE, {7}};
+    rules[2].filters.severities = {common::filter_type::INCLUDE, {common::log_severity::ERROR, common::log_severity::FATAL}};
+
+    rules[3] = make_rule(3, "not from scope \"noisy\"");
+    rules[3].filters.scopes = {common::filter_type::EXCLUDE, {"noisy"}};
+
+    rules[4] = make_rule(4, "http status 500");
+    rules[4].filters.attribute_values = {common::filter_type::INCLUDE, glz::generic::object_t{
+        {"http", glz::generic::object_t{{"status", 500.0}}}
+    }};
+
+    rules[5] = make_rule(5, "tagged \"db\"");
+    rules[5].filters.attribute_values = {common::filter_type::INCLUDE, glz::generic::object_t{
+        {"tags", glz::generic::array_t{"db"}}
+    }};
+
+    rules[6] = make_rule(6, "disabled");
+    rules[6].enabled = false;
+
+    rules[7] = make_rule(7, "tags is \"db\"");
+    rules[7].filters.attribute_values = {common::filter_type::INCLUDE, glz::generic::object_t{
+        {"tags", "db"}
+    }};
+
+    common::rule_matcher<common::alert_rule> matcher{rules};
+
+    auto check = [&](std::string_view description, const common::log_entry& log, const std::set<unsigned int>& expected) {
+        std::cout << description << ":";
+        bool consistent = true;
+        std::set<unsigned int> matched;
+        matcher.for_each_match(log, [&](const common::alert_rule& rule) {
+            std::cout << " " << rule.id;
+            matched.insert(rule.id);
+        });
+        for(const auto& [id, rule] : rules) {
+            consistent &= rule.match(log) == matched.contains(id);
+        }
+        std::cout << (consistent ? "" : " (differs from standard_filters::match!)");
+        std::cout << (matched == expected ? "" : " (unexpected matches!)") << std::endl;
+        return consistent && matched == expected;
+    };
+    auto check_contains = [](std::string_view container, std::string_view contained, bool expected) {
+        auto a = glz::read_json<glz::generic>(container);
+        auto b = glz::read_json<glz::generic>(contained);
+        bool result = a && b && common::json_contains(*a, *b);
+        std::cout << container << " @> " << contained << ": " << (result ? "true" : "false")
+            << (result == expected ? "" : " (differs from PostgreSQL!)") << std::endl;
+        return a && b && result == expected;
+    };
+
+    common::log_entry log{};
+    log.resource = 7;
+    log.scope = "noisy";
+    log.severity = common::log_severity::ERROR;
+    log.attributes = glz::generic::object_t{
+        {"http", glz::generic::object_t{{"status", 500.0}, {"method", "GET"}}},
+        {"tags", glz::generic::array_t{"db", "slow"}}
+    };
+
+    bool ok = true;
+    ok &= check("error from resource 7 in scope noisy", log, {1, 2, 4, 5});
+
+    log.resource = 8;
+    log.scope = "quiet";
+    log.severity = common::log_severity::INFO;
+    log.attributes = glz::generic::object_t{
+        {"http", glz::generic::object_t{{"status", 200.0}}},
+        {"tags", "db"}
+    };
+    ok &= check("info from resource 8 in scope quiet", log, {1, 3, 7});
+
+    log.severity = static_cast<common::log_severity>(100);
+    ok &= check("unknown severity", log, {1, 3, 7});
+
+    // expected results are the ones of the jsonb @> operator
+    ok &= check_contains(R"({"a": 1, "b": {"c": 2, "d": 3}})", R"({"b": {"c": 2}})", true);
+    ok &= check_contains(R"({"a": 1})", R"({"a": 1, "b": 2})", false);
+    ok &= check_contains(R"({"a": 1})", R"({})", true);
+    ok &= check_contains(R"({"a": 1})", R"([])", false);
+    ok &= check_contains(R"(["a", "b"])", R"("a")", true);
+    ok &= check_contains(R"(["a", "b"])", R"(["b", "a", "a"])", true);
+    ok &= check_contains(R"(["a", "b"])", R"([])", true);
+    ok &= check_contains(R"("a")", R"("a")", true);
+    ok &= check_contains(R"("a")", R"(["a"])", false);
+    ok &= check_contains(R"([["a", "b"]])", R"(["a"])", false);
+    ok &= check_contains(R"([["a", "b"]])", R"([["a"]])", true);
+    ok &= check_contains(R"({"tags": ["db"]})", R"({"tags": "db"})", false);
+    ok &= check_contains(R"([{"a": 1, "b": 2}])", R"([{"a": 1}])", true);
+    ok &= check_contains(R"({"n": 1})", R"({"n": 1.0})", true);
+    ok &= check_contains(R"({"n": 1})", R"({"n": 2})", false);
+    ok &= check_contains(R"({"n": 1})", R"({"n": "1"})", false);
+    ok &= check_contains(R"({"n": null})", R"({"n": null})", true);
+    ok &= check_contains(R"({"n": false})", R"({"n": null})", false);
+
+    return ok ? 0 : 1;
+}
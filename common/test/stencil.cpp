@@ -116,5 +116,37 @@ int main() {
         return std::string{"error: "} + err;
     }) << std::endl;
 
+    auto compiled = common::compiled_stencil::compile("{?value1}yes{:?}no{/?} \\{{x | add_5}\\}\\t{?value2}{?value1}yes{:?}no{/?}{/?}");
+    if(!compiled) {
+        std::cout << "error: " << compiled.error() << std::endl;
+        return 1;
+    }
+    std::string buffer;
+    for(int i = 0; i < 3; i++) {
+        int b = a + i;
+        test t{
+            .value1 = i % 2 == 1,
+            .value2 = true,
+            .x = &b,
+            .y = nullptr
+        };
+        buffer.clear();
+        if(auto r = compiled->render_to(buffer, t, fn); !r) {
+            std::cout << "error: " << r.error() << std::endl;
+            return 1;
+        }
+        std::cout << buffer << std::endl;
+    }
+
+    std::cout << *common::stencil("{attributes.missing?}|{attributes.key | string(fixed)}", resource).or_else([](auto&& err) -> std::expected<std::string, std::string> {
+        return std::string{"error: "} + err;
+    }) << std::endl;
+
+    for(auto invalid : {"{x", "{?value1}yes", "{?value2}yes{:?}no", "\\q", "{x | add(1}"}) {
+        std::cout << invalid << ": " << *common::stencil(invalid, my_test).or_else([](auto&& err) -> std::expected<std::string, std::string> {
+            return std::string{"error: "} + err;
+        }) << std::endl;
+    }
+
     return 0;
 }
@@ -78,7 +78,11 @@ export class logs : public page {
                     webpp::get_element_by_id("run_button_icon")->add_class("hidden");
                     webpp::get_element_by_id("run_button_loading")->remove_class("hidden");
 
-                    if(!is_last_page) { current_page++; }
+                    if(!is_last_page) {
+                        page_cursors.resize(current_page + 1);
+                        page_cursors.push_back(next_cursor);
+                        current_page++;
+                    }
                     webpp::coro::submit(run_query());
                 }),
             };
@@ -89,9 +93,8 @@ export class logs : public page {
             std::string scopes_selector = build_scopes_selector(selected_scopes);
             std::string resources_selector = build_resources_selector(selected_resources);
 
-            unsigned int offset = current_page * page_limit;
-            auto url = std::format("/api/v1/logs?limit={}&offset={}&attributes={}&scopes={}&resources={}",
-                page_limit, offset, attributes_selector, scopes_selector, resources_selector);
+            auto url = std::format("/api/v1/logs?limit={}&after={}&attributes={}&scopes={}&resources={}{}",
+                page_limit, glz::url_encode(page_cursors[current_page]), attributes_selector, scopes_selector, resources_selector, build_time_selector("time_window"));
             common::logs_response logs{};
             if(auto error = glz::read_beve_delimited<common::beve_opts, common::logs_response>(logs,
                 co_await webpp::coro::fetch(url, utils::fetch_options).then(std::mem_fn(&webpp::response::co_bytes))))
@@ -100,16 +103,18 @@ export class logs : public page {
                     glz::format_error(error), std::chrono::seconds(30));
             }
             is_last_page = logs.size() < page_limit;
+            next_cursor = logs.empty() ? "" : common::log_cursor::after(logs.back()).encode();
 
             webpp::get_element_by_id("run_button_icon")->remove_class("hidden");
             webpp::get_element_by_id("run_button_loading")->add_class("hidden");
 
             using namespace Webxx;
+            auto compiled = common::compiled_stencil::compile(stencil_format);
             auto list = ul{{_class{"list rounded-box shadow gap-1"}},
                 each(logs, [&](const auto& entry) {
                     const auto& res = resources->resources.find(entry.resource);
                     auto obj = common::log_entry_stencil_object::create(entry, resources->resources);
-                    auto r = common::stencil(stencil_format, obj, stencil_functions);
+                    auto r = compiled.and_then([&](const common::compiled_stencil& c) { return c.render(obj, stencil_functions); });
                     return li{{_class{"list-item"}},
                         code{{_class{r ? "whitespace-pre" : "whitespace-pre text-error font-bold"}},
                             sanitize(*r.or_else([](auto err) -> decltype(r) { return "Stencil invalid: \"{}\""_(err); }))}
@@ -129,9 +134,8 @@ export class logs : public page {
             std::string scopes_selector = build_scopes_selector(selected_scopes);
             std::string resources_selector = build_resources_selector(selected_resources);
 
-            unsigned int offset = current_page * page_limit;
-            auto url = std::format("/api/v1/logs/stencil?limit={}&offset={}&attributes={}&scopes={}&resources={}&stencil={}",
-                limit, offset, attributes_selector, scopes_selector, resources_selector, glz::url_encode(stencil_format));
+            auto url = std::format("/api/v1/logs/stencil?limit={}&after={}&attributes={}&scopes={}&resources={}{}&stencil={}",
+                limit, glz::url_encode(page_cursors[current_page]), attributes_selector, scopes_selector, resources_selector, build_time_selector("time_window"), glz::url_encode(stencil_format));
             webpp::eval("window.open({}, '_blank');", glz::write_json(url).value_or("\"error\""));
 
             co_return;
@@ -228,6 +232,8 @@ export class logs : public page {
         std::unordered_map<std::string, std::tuple<std::string, unsigned int>> transformed_resources;
 
         unsigned int current_page = 0;
+        std::vector<std::string> page_cursors{""}; // cursor to fetch each visited page with, the first page has none
+        std::string next_cursor;
         bool is_last_page = false;
         constexpr static unsigned int page_limit = 100;
     public:
@@ -266,6 +272,7 @@ export class logs : public page {
                     dv{{_class{"flex flex-col md:flex-row gap-4 items-center"}},
                         dv{{_id{"display"}, _class{"grow w-full"}}, page_display_options()},
                         dv{{_class{"flex flex-row md:flex-col gap-4"}},
+                            time_window_select("time_window"),
                             ctx.on_click(button{{_class{"btn btn-primary"}},
                                 span{{_id{"run_button_loading"}, _class{"loading loading-spinner hidden"}}},
                                 span{{_id{"run_button_icon"}}, assets::icons::run},
@@ -275,6 +282,7 @@ export class logs : public page {
                                 webpp::get_element_by_id("run_button_loading")->remove_class("hidden");
 
                                 current_page = 0;
+                                page_cursors = {""};
                                 webpp::coro::submit(run_query());
                             }),
                             dv{{_class{"dropdown dropdown-hover dropdown-top md:dropdown-bottom dropdown-end"}},
@@ -57,7 +57,11 @@ export class table : public page {
                     webpp::get_element_by_id("run_button_icon")->add_class("hidden");
                     webpp::get_element_by_id("run_button_loading")->remove_class("hidden");
 
-                    if(!is_last_page) { current_page++; }
+                    if(!is_last_page) {
+                        page_cursors.resize(current_page + 1);
+                        page_cursors.push_back(next_cursor);
+                        current_page++;
+                    }
                     webpp::coro::submit(run_query());
                 }),
             };
@@ -262,9 +266,8 @@ export class table : public page {
             std::string scopes_selector = build_scopes_selector(selected_scopes);
             std::string resources_selector = build_resources_selector(selected_resources);
 
-            unsigned int offset = current_page * page_limit;
-            auto url = std::format("/api/v1/logs?limit={}&offset={}&attributes={}&scopes={}&resources={}",
-                page_limit, offset, attributes_selector, scopes_selector, resources_selector);
+            auto url = std::format("/api/v1/logs?limit={}&after={}&attributes={}&scopes={}&resources={}{}",
+                page_limit, glz::url_encode(page_cursors[current_page]), attributes_selector, scopes_selector, resources_selector, build_time_selector("time_window"));
             if(auto error = glz::read_beve_delimited<common::beve_opts, common::logs_response>(logs,
                 co_await webpp::coro::fetch(url, utils::fetch_options).then(std::mem_fn(&webpp::response::co_bytes))))
             {
@@ -272,6 +275,7 @@ export class table : public page {
                     glz::format_error(error), std::chrono::seconds(30));
             }
             is_last_page = logs.size() < page_limit;
+            next_cursor = logs.empty() ? "" : common::log_cursor::after(logs.back()).encode();
 
             webpp::get_element_by_id("run_button_icon")->remove_class("hidden");
             webpp::get_element_by_id("run_button_loading")->add_class("hidden");
@@ -334,6 +338,8 @@ export class table : public page {
         std::unordered_map<std::string, std::tuple<std::string, unsigned int>> transformed_resources;
 
         unsigned int current_page = 0;
+        std::vector<std::string> page_cursors{""}; // cursor to fetch each visited page with, the first page has none
+        std::string next_cursor;
         bool is_last_page = false;
         constexpr static unsigned int page_limit = 100;
     public:
@@ -457,6 +463,7 @@ export class table : public page {
                         dv{{_id{"scopes"},     _class{"md:basis-0 md:grow *:max-h-60"}}, components::selection<"scopes">("Filter Scopes"_, scopes->scopes, selected_scopes, &profile, 1, false)},
                     },
                     dv{{_class{"flex flex-col md:flex-row gap-4 mt-4 justify-center"}},
+                        time_window_select("time_window"),
                         ctx.on_click(button{{_class{"btn btn-primary"}},
                             span{{_id{"run_button_loading"}, _class{"loading loading-spinner hidden"}}},
                             span{{_id{"run_button_icon"}}, assets::icons::run},
@@ -466,6 +473,7 @@ export class table : public page {
                             webpp::get_element_by_id("run_button_loading")->remove_class("hidden");
 
                             current_page = 0;
+                            page_cursors = {""};
                             webpp::coro::submit(run_query());
                         }),
                         ctx.on_click(button{{_id{"reset_table_button"}, _class{"btn btn-secondary btn-disabled"}},
@@ -2,6 +2,7 @@ export module frontend.pages:utils;
 
 import std;
 import webpp;
+import webxx;
 import i18n;
 import glaze;
 
@@ -90,4 +91,35 @@ std::string build_resources_selector(const std::unordered_map<std::string, bool>
     return resources_selector+"0";
 }
 
+// Queries default to a recent time window, so the backend only has to scan the newest partitions
+constexpr unsigned int default_time_window = 24 * 60 * 60;
+
+auto time_window_select(std::string_view id, unsigned int selected = default_time_window) {
+    using namespace Webxx;
+    return select{{_id{std::string{id}}, _class{"select"}},
+        each(std::array{
+            std::make_pair<std::string_view, unsigned int>("Last 15 minutes"_, 15 * 60),
+            std::make_pair<std::string_view, unsigned int>("Last hour"_, 60 * 60),
+            std::make_pair<std::string_view, unsigned int>("Last 24 hours"_, 24 * 60 * 60),
+            std::make_pair<std::string_view, unsigned int>("Last 7 days"_, 7 * 24 * 60 * 60),
+            std::make_pair<std::string_view, unsigned int>("Last 30 days"_, 30 * 24 * 60 * 60),
+            std::make_pair<std::string_view, unsigned int>("All time"_, 0),
+        }, [&](const auto& e) {
+            if(e.second == selected) {
+                return option{{_value{std::to_string(e.second)}, _selected{}}, e.first};
+            } else {
+                return option{{_value{std::to_string(e.second)}}, e.first};
+            }
+        })
+    };
+}
+std::string build_time_selector(std::string_view id) {
+    auto element = webpp::get_element_by_id(id);
+    std::string since = element ? element->get_property<std::string>("value").value_or("0") : "0";
+    if(since.empty() || since == "0") {
+        return "";
+    }
+    return "&since=" + since;
+}
+
 }
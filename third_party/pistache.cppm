@@ -1,6 +1,8 @@
 module;
 
+#include <chrono>
 #include <cstdint>
+#include <string>
 
 #include <pistache/async.h>
 #include <pistache/endpoint.h>
@@ -95,8 +97,30 @@ export namespace Pistache {
                     bool m_all;
                     std::vector<ETag> m_etags;
             };
+            class RetryAfter : public Header {
+                public:
+                    static constexpr const char* Name = "Retry-After";
+                    const char* name() const override { return Name; }
+                    static constexpr uint64_t Hash = Pistache::Http::Header::detail::hash(Name);
+                    uint64_t hash() const override { return Hash; }
+
+                    RetryAfter() = default;
+                    explicit RetryAfter(std::chrono::seconds delay) : m_delay(delay) {}
+
+                    void parse(const std::string& value) override {
+                        m_delay = std::chrono::seconds{std::stoll(value)};
+                    }
+                    void write(std::ostream& os) const override {
+                        os << m_delay.count();
+                    }
+
+                    std::chrono::seconds delay() const { return m_delay; }
+                private:
+                    std::chrono::seconds m_delay{0};
+            };
             namespace super_hacky_registration {
                 inline Registrar<IfNoneMatch> RegisterIfNoneMatch{};
+                inline Registrar<RetryAfter> RegisterRetryAfter{};
             }
         }
         namespace Mime {